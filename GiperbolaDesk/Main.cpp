@@ -1,4 +1,7 @@
 ﻿#include "include/Desk.hpp"
+#include "include/HostDaemon.hpp"
+#include "include/ScreenManager.hpp"
+#include <csignal>
 
 
 //int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
@@ -29,8 +32,58 @@
 //    return 0;
 //}
 
+static std::atomic<bool> host_running{ true };
+
+// Headless host: GiperbolaDesk --host LOCAL_IP PORT VIEWER_IP:PORT[,quality=N][,fps=N][,lossless] ...
+// Every viewer is a session of its own on PORT, PORT + 2 and so on (plus the control port after each).
+static int run_host(int argc, char* argv[])
+{
+    if (argc < 5) {
+        std::cerr << "usage: GiperbolaDesk --host LOCAL_IP PORT VIEWER_IP:PORT[,quality=N][,fps=N][,lossless] ..." << std::endl;
+        return 1;
+    }
+
+    HostDaemon daemon([](const MonitorInfo& monitor) -> FrameSource {
+        return [monitor] { return ScreenManager::capture_monitor(monitor); };
+    }, ScreenManager::monitors(), 0, parse_cpu_budget(std::getenv(CPU_BUDGET_ENV)));
+
+    try {
+        for (int i = 4; i < argc; i++) {
+            SessionConfig config;
+            config.localIp = argv[2];
+            config.localPort = static_cast<unsigned int>(std::stoi(argv[3]) + 2 * (i - 4));
+            config.lossless = std::getenv(LOSSLESS_ENV) != nullptr;
+            if (!parse_session_spec(argv[i], config)) {
+                std::cerr << "Invalid session: " << argv[i] << std::endl;
+                return 1;
+            }
+            daemon.add_session(config);
+            std::cout << "Serving " << config.viewerIp << ":" << config.viewerPort << " on port " << config.localPort << std::endl;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    Stats::start_reporter(STATS_FILE, STATS_INTERVAL, "host, " + std::to_string(daemon.session_count()) +
+        " sessions on " + std::to_string(daemon.worker_count()) + " workers");
+    std::signal(SIGINT, [](int) { host_running = false; });
+    while (host_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    daemon.stop();
+    Stats::stop_reporter();
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
+    if (argc >= 2 && std::string(argv[1]) == "--host") {
+        return run_host(argc, argv);
+    }
+
     std::string ip = "127.0.0.1";
     unsigned int port = 8888;
 
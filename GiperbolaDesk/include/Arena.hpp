@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr size_t ARENA_BLOCK_SIZE = 16 * 1024;
+constexpr size_t ARENA_MAX_SIZE = 1024 * 1024;
+
+
+// Arena
+
+// Monotonic allocator for short-lived metadata: allocation bumps an offset, freeing is
+// a no-op and reset() makes all of it reusable at once. Blocks are kept across resets,
+// and a reset after the arena had to grow folds them into one block of the total size,
+// so a steady workload stops calling the heap after its first few frames. Growth shows
+// up in Stats as arena_growths.
+
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+public:
+    void* allocate(size_t size, size_t alignment);
+    void reset();
+    size_t used() const;
+    size_t capacity() const;
+
+private:
+    struct Block
+    {
+        uint8_t* bytes;
+        size_t size;
+    };
+
+    void grow(size_t size);
+
+private:
+    std::vector<Block> blocks_;
+    size_t blockSize_;
+    size_t current_ = 0;
+    size_t offset_ = 0;
+    size_t used_ = 0;
+};
+
+
+// ArenaAllocator
+
+// Lets standard containers place their nodes in an Arena; deallocate() leaves the memory
+// to the next reset().
+
+template <typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena* arena) : arena_(arena) { }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) { }
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(arena_->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) { }
+
+    Arena* arena() const
+    {
+        return arena_;
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return arena_ == other.arena();
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return arena_ != other.arena();
+    }
+
+private:
+    Arena* arena_;
+};
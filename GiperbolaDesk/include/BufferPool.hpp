@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+constexpr size_t BUFFER_ALIGNMENT = 64;
+constexpr size_t BUFFER_MIN_SIZE = 4 * 1024;
+constexpr size_t BUFFER_SIZE_CLASSES = 16;
+constexpr size_t BUFFER_KEEP_PER_CLASS = 8;
+
+
+// FrameBuffer
+
+// Reference-counted handle to a pooled byte buffer. Copies share the bytes; the block
+// goes back to BufferPool when the last handle lets go. One frame's encoded bytes or
+// reassembled payload live in one of these from the stage that writes them to the
+// stage that consumes them, so they are never copied in between.
+
+class FrameBuffer
+{
+public:
+    FrameBuffer() = default;
+    FrameBuffer(const FrameBuffer& other);
+    FrameBuffer(FrameBuffer&& other) noexcept;
+    FrameBuffer& operator=(const FrameBuffer& other);
+    FrameBuffer& operator=(FrameBuffer&& other) noexcept;
+    ~FrameBuffer();
+
+public:
+    uint8_t* data();
+    const uint8_t* data() const;
+    size_t size() const;
+    size_t capacity() const;
+    bool empty() const;
+    // Shrinks in place; growing past capacity() moves the bytes into a bigger block.
+    void resize(size_t size);
+    long use_count() const;
+
+private:
+    friend class BufferPool;
+
+    struct Block
+    {
+        std::atomic<long> refs{ 1 };
+        size_t sizeClass = 0;
+        size_t capacity = 0;
+        uint8_t* bytes = nullptr;
+    };
+
+    FrameBuffer(Block* block, size_t size);
+    void release();
+
+private:
+    Block* block_ = nullptr;
+    size_t size_ = 0;
+};
+
+
+// BufferPool
+
+// Power-of-two size classes from BUFFER_MIN_SIZE up, every block BUFFER_ALIGNMENT
+// aligned. Each class keeps up to BUFFER_KEEP_PER_CLASS released blocks for reuse;
+// anything above the largest class is allocated and freed on its own. Fresh
+// allocations, reuses and bytes copied between stages show up in Stats.
+
+class BufferPool
+{
+public:
+    static FrameBuffer acquire(size_t size);
+    static void count_copy(size_t bytes);
+    static void trim();
+
+private:
+    friend class FrameBuffer;
+
+    static size_t sizeClass(size_t size);
+    static size_t classBytes(size_t sizeClass);
+    static void recycle(FrameBuffer::Block* block);
+
+private:
+    static std::mutex mutex_;
+    static std::array<std::vector<FrameBuffer::Block*>, BUFFER_SIZE_CLASSES> free_;
+};
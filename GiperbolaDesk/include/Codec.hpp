@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "Stats.hpp"
+
+constexpr int PALETTE_MAX_COLORS = 256;
+constexpr int PALETTE_FEW_COLORS = 16;
+constexpr double PALETTE_MAX_EDGES = 0.35;
+constexpr int SHARP_EDGE_CONTRAST = 48;
+
+enum class ImageClass : uint8_t
+{
+    Synthetic,
+    Natural
+};
+
+enum class PixelCodec : uint8_t
+{
+    Jpeg,
+    Palette,
+    Qoi,
+    Count
+};
+
+const char* codec_name(PixelCodec codec);
+
+class Codec
+{
+public:
+    static std::vector<uint8_t> encode_jpg(const cv::Mat& img, int quality = 85);
+    static cv::Mat decode_jpg(const uint8_t* data, size_t size);
+    static bool decode_rgba(const uint8_t* data, size_t size, std::vector<uint8_t>& rgba, int& width, int& height);
+
+    static ImageClass classify(const cv::Mat& img);
+    static bool encode_palette(const cv::Mat& img, std::vector<uint8_t>& out);
+    static bool decode_palette(const uint8_t* data, size_t size, int width, int height, std::vector<uint8_t>& rgba);
+    static void encode_qoi(const cv::Mat& img, std::vector<uint8_t>& out);
+    static bool decode_qoi(const uint8_t* data, size_t size, int width, int height, std::vector<uint8_t>& rgba);
+
+    // Every codec behind one call; the size is known from the rect, so the payloads
+    // carry no header of their own except JPEG's.
+    static bool encode(PixelCodec codec, const cv::Mat& img, std::vector<uint8_t>& out, int quality = 85);
+    static bool decode(PixelCodec codec, const uint8_t* data, size_t size, int width, int height, std::vector<uint8_t>& rgba);
+};
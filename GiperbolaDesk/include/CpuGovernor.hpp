@@ -0,0 +1,74 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+constexpr const char* CPU_BUDGET_ENV = "DESK_CPU_BUDGET";
+constexpr std::chrono::milliseconds GOVERNOR_WINDOW{ 1000 };
+constexpr std::chrono::milliseconds GOVERNOR_BURST{ 100 };
+constexpr double GOVERNOR_MIN_FPS = 5.0;
+constexpr double GOVERNOR_RESTORE_USAGE = 0.5;
+constexpr std::array<int, 4> GOVERNOR_QUALITY{ 100, 70, 55, 40 };
+constexpr std::array<double, 3> GOVERNOR_SCALE{ 1.0, 0.75, 0.5 };
+
+// Parses a DESK_CPU_BUDGET value: "15%" is 15% of one core, "2" two cores; 0 (no limit) if unset or invalid.
+double parse_cpu_budget(const char* value);
+
+
+// CpuGovernor
+
+// Keeps the host inside a CPU budget shared by all its streams and sessions. Every frame
+// is charged what its capture, encode and send took on the streaming thread, against a
+// credit that refills at the budget rate. Out of credit, admit() holds the next frame
+// back, so the frame rate goes down first. When that leaves a stream under
+// GOVERNOR_MIN_FPS for a whole window, the quality steps down, and after the last quality
+// step the resolution. Once a window uses less than half the budget without throttling,
+// the steps are undone in reverse order.
+
+class CpuGovernor
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Status
+    {
+        double budget = 0.0;
+        double usage = 0.0;
+        double fps = 0.0;
+        size_t qualityStep = 0;
+        size_t scaleStep = 0;
+    };
+
+    explicit CpuGovernor(double budget = 0.0);
+
+public:
+    bool enabled() const;
+    // Earliest time the next frame may start.
+    Clock::time_point admit();
+    // Charges one frame of the given stream; stream only tells streams apart.
+    void record(const void* stream, std::chrono::microseconds cost);
+    int quality(int requested) const;
+    double scale() const;
+    Status status() const;
+
+private:
+    void refill(Clock::time_point now);
+    void evaluate(Clock::time_point now);
+
+private:
+    const double budget_;
+    mutable std::mutex mutex_;
+    double credit_ = 0.0;
+    Clock::time_point refilled_;
+    Clock::time_point windowStart_;
+    double windowCost_ = 0.0;
+    uint64_t windowFrames_ = 0;
+    std::vector<const void*> windowStreams_;
+    bool throttled_ = false;
+    size_t qualityStep_ = 0;
+    size_t scaleStep_ = 0;
+    double usage_ = 0.0;
+    double fps_ = 0.0;
+};
@@ -0,0 +1,208 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "BufferPool.hpp"
+#include "Codec.hpp"
+#include "MotionCodec.hpp"
+#include "Protocol.hpp"
+#include "RegionTracker.hpp"
+#include "ScrollDetector.hpp"
+#include "Stats.hpp"
+#include "TileCache.hpp"
+#include "TileStore.hpp"
+
+constexpr int KEYFRAME_INTERVAL = 30;
+constexpr int DIRTY_BAND_GAP = 8;
+constexpr int MOTION_KEYFRAME_INTERVAL = 120;
+constexpr double MOTION_ENTER_RATIO = 0.5;
+constexpr double MOTION_EXIT_RATIO = 0.2;
+constexpr int MOTION_ENTER_FRAMES = 5;
+constexpr int MOTION_EXIT_FRAMES = 15;
+constexpr int VIDEO_REFRESH_INTERVAL = 6;
+constexpr int DRAFT_QUALITY = 40;
+constexpr int REFINE_SHARP_FRAMES = 6;
+constexpr int REFINE_EXACT_FRAMES = 30;
+constexpr size_t REFINE_FRAME_BYTES = 32 * 1024;
+constexpr size_t REFINE_RUN_TILES = 4;
+constexpr size_t UNACKED_FRAMES = 128;
+constexpr int VIEWPORT_REFRESH_INTERVAL = 10;
+constexpr size_t CACHED_TILE_COST = FrameUpdate::RECT_SIZE + TileHash::SIZE;
+
+struct TileCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytesSaved = 0;
+    uint64_t missing = 0;
+    uint64_t refined = 0;
+};
+
+enum class RefineLevel : uint8_t
+{
+    Draft,
+    Sharp,
+    Exact
+};
+
+
+// FrameEncoder
+
+// Turns captured frames into FrameUpdate payloads. If the previous frame scrolled, the
+// update is a copy rect plus bands of whatever still differs; otherwise the frame is cut
+// into tiles and every tile the viewer already caches is sent as a reference. New pixels
+// go out as lossless palette data when Codec::classify() calls them synthetic, else as a
+// DRAFT_QUALITY JPEG, or as QOI in a lossless session.
+// Drafts that stay put are refined with whatever REFINE_FRAME_BYTES the frame has left:
+// to a full-quality JPEG after REFINE_SHARP_FRAMES and to QOI after REFINE_EXACT_FRAMES.
+// Every KEYFRAME_INTERVAL frames, or when the viewer asks, a keyframe heals lost updates:
+// it only references tiles the viewer listed through seed_cache() or acknowledged
+// receiving through confirm_frame().
+// When most of the screen keeps changing without scrolling (video, animations) the
+// encoder switches to motion mode: one JPEG keyframe, then motion-compensated residuals
+// against what the viewer reconstructed, until the changes die down again.
+// Smaller areas that keep changing (a video player in a browser) become video regions:
+// they get the same motion coding every frame, while the rest of the screen is only
+// compared and sent every VIDEO_REFRESH_INTERVAL frames.
+// A viewer that zooms in reports its viewport through set_viewport(): tiles outside it
+// are only compared every VIEWPORT_REFRESH_INTERVAL frames and stay drafts, and video
+// regions outside it wait for the next refresh.
+
+class FrameEncoder
+{
+public:
+    explicit FrameEncoder(int quality = 85, bool lossless = false);
+
+public:
+    FrameBuffer encode(const cv::Mat& frame, uint32_t frameId);
+    const TileCacheStats& cache_stats() const;
+    void seed_cache(const std::vector<CacheEntry>& entries);
+    void request_keyframe();
+    void confirm_frame(uint32_t frameId);
+    void set_viewport(const cv::Rect& area);
+    // JPEG quality of what is sent from now on; lossless tiles are unaffected.
+    void set_quality(int quality);
+    bool motion_mode() const;
+    std::vector<cv::Rect> video_regions() const;
+
+private:
+    struct SentTile
+    {
+        uint32_t cost = 0;
+        bool confirmed = false;
+        RefineLevel level = RefineLevel::Draft;
+        uint32_t frameId = 0;
+    };
+
+    struct GridTile
+    {
+        TileHash hash;
+        uint64_t changedAt = 0;
+    };
+
+    struct Refinement
+    {
+        cv::Rect area;
+        TileHash hash;
+        RefineLevel level;
+    };
+
+    struct VideoRegion
+    {
+        cv::Rect area;
+        cv::Mat reconstructed;
+    };
+
+    bool addPixels(FrameUpdate& update, const cv::Mat& frame, const cv::Rect& area, ImageClass imageClass,
+        bool tiled = false, RefineLevel level = RefineLevel::Sharp);
+    void addDirtyBands(FrameUpdate& update, const cv::Mat& reference, const cv::Mat& frame);
+    void addTiles(FrameUpdate& update, const cv::Mat& frame, bool keyframe);
+    void addTileRun(FrameUpdate& update, const cv::Mat& frame, const cv::Rect& area, std::vector<TileHash>& hashes,
+        ImageClass imageClass, RefineLevel level);
+    void refineTiles(FrameUpdate& update, const cv::Mat& frame);
+    RefineLevel firstLevel(ImageClass imageClass) const;
+    void markSent(const std::vector<TileHash>& hashes, uint32_t cost, RefineLevel level);
+    void addMotion(FrameUpdate& update, const cv::Mat& frame, const cv::Rect& area, cv::Mat& reconstructed, bool keyframe);
+    bool updateMode(double changedRatio);
+    void updateRegions(const cv::Mat& frame, bool track);
+    bool inRegion(const cv::Rect& tile) const;
+    bool inViewport(const cv::Rect& area) const;
+
+private:
+    int quality_;
+    bool lossless_;
+    cv::Mat previous_;
+    cv::Mat predicted_;
+    uint32_t previousId_ = 0;
+    uint32_t frameId_ = 0;
+    int sinceKeyframe_ = 0;
+    bool keyframeRequested_ = false;
+    bool motion_ = false;
+    int modeFrames_ = 0;
+    cv::Mat reconstructed_;
+    cv::Mat prediction_;
+    cv::Mat residual_;
+    RegionTracker tracker_;
+    std::vector<VideoRegion> regions_;
+    std::vector<uint8_t> changedBlocks_;
+    int sinceRefresh_ = 0;
+    cv::Rect viewport_;
+    int sinceOutside_ = 0;
+    uint64_t frames_ = 0;
+    std::vector<GridTile> grid_;
+    std::vector<Refinement> refine_;
+    std::vector<TileHash> sentNow_;
+    std::deque<std::pair<uint32_t, std::vector<TileHash>>> unacked_;
+    TileCache<SentTile> sent_;
+    TileCacheStats stats_;
+};
+
+
+// FrameDecoder
+
+// Keeps the viewer's RGBA canvas and tile cache and applies FrameUpdate payloads to them.
+// Cached pixels live in a TileStore; attach_store() moves them into a file that a later
+// session with the same host picks up again.
+
+class FrameDecoder
+{
+public:
+    FrameDecoder();
+
+    bool apply(const uint8_t* data, size_t size, uint32_t frameId);
+    const std::vector<uint8_t>& pixels() const;
+    int width() const;
+    int height() const;
+    const TileCacheStats& cache_stats() const;
+    bool attach_store(const std::string& path);
+    std::vector<CacheEntry> cached_tiles() const;
+
+private:
+    struct CachedTile
+    {
+        uint32_t slot = 0;
+        uint32_t cost = 0;
+        bool exact = false;
+    };
+
+    bool drawPixels(const UpdateRect& rect);
+    bool drawCachedTile(const UpdateRect& rect);
+    bool drawMotion(const UpdateRect& rect);
+    bool copyRect(const UpdateRect& rect);
+    void storeTiles(const UpdateRect& rect);
+    void loadSlots();
+
+private:
+    FrameUpdate update_;
+    TileCache<CachedTile> tiles_;
+    TileStore store_;
+    std::vector<uint32_t> freeSlots_;
+    TileCacheStats stats_;
+    std::vector<uint8_t> canvas_;
+    std::vector<uint8_t> scratch_;
+    std::vector<uint8_t> reference_;
+    int width_ = 0;
+    int height_ = 0;
+    uint32_t frameId_ = 0;
+};
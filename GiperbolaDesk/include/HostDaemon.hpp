@@ -0,0 +1,128 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "CpuGovernor.hpp"
+#include "FrameCodec.hpp"
+#include "Network.hpp"
+#include "WorkerPool.hpp"
+
+constexpr std::chrono::milliseconds CACHE_ANNOUNCE_POLL{ 5 };
+constexpr std::chrono::milliseconds SUBSCRIPTION_POLL{ 20 };
+constexpr int HOST_QUALITY = 85;
+
+// Produces the next picture of one monitor.
+using FrameSource = std::function<cv::Mat()>;
+// Opens a FrameSource for a monitor; called once for every stream a viewer subscribes to.
+using FrameSourceFactory = std::function<FrameSource(const MonitorInfo&)>;
+
+
+// HostStream
+
+// One monitor of one session on the host: capture, encode and send of a frame, with the
+// encoder state carried from frame to frame. step() never blocks; it returns when it
+// wants to run next, so it works in a thread of its own and as a pool task alike.
+// With a governor every frame is charged to it, and it sets frame rate, quality and scale.
+
+class HostStream
+{
+public:
+    HostStream(Network& network, uint8_t streamId, FrameSource source, int quality, bool lossless, int fps = 0,
+        CpuGovernor* governor = nullptr);
+
+public:
+    std::chrono::steady_clock::time_point step();
+
+private:
+    Network& network_;
+    uint8_t streamId_;
+    FrameSource source_;
+    FrameEncoder encoder_;
+    CpuGovernor* governor_;
+    int quality_;
+    std::optional<std::vector<CacheEntry>> entries_;
+    std::vector<uint32_t> acks_;
+    std::chrono::steady_clock::time_point cacheDeadline_;
+    std::chrono::steady_clock::time_point next_;
+    std::chrono::microseconds interval_{ 0 };
+    bool waitingForCache_ = true;
+};
+
+
+// SessionConfig
+
+// One viewer served by a HostDaemon. Parsed from "IP:PORT[,quality=N][,fps=N][,lossless]";
+// the session listens on localPort and localPort + CONTROL_PORT_OFFSET.
+
+struct SessionConfig
+{
+    std::string localIp = "0.0.0.0";
+    unsigned int localPort = 0;
+    std::string viewerIp;
+    unsigned int viewerPort = 0;
+    int quality = HOST_QUALITY;
+    bool lossless = false;
+    int fps = 0;
+};
+
+bool parse_session_spec(const std::string& spec, SessionConfig& config);
+
+
+// HostDaemon
+
+// Headless host serving any number of independent sessions from one process. Every
+// subscribed stream of every session is a chain of HostStream steps on one shared
+// WorkerPool: a step schedules the next one when it finishes, so sessions take turns on
+// the cores instead of each holding blocked threads. Receiving stays on the threads of
+// each session's Network.
+
+class HostDaemon
+{
+public:
+    // cpuBudget is shared by all sessions, in cores; 0 leaves the host unlimited.
+    HostDaemon(FrameSourceFactory sources, std::vector<MonitorInfo> monitors, size_t workers = 0, double cpuBudget = 0.0);
+    ~HostDaemon();
+
+public:
+    // Opens the session's sockets (throws like Network::open) and starts serving it.
+    Network& add_session(const SessionConfig& config);
+    void stop();
+    size_t session_count() const;
+    Network& session(size_t index);
+    size_t worker_count() const;
+    CpuGovernor::Status governor_status() const;
+
+private:
+    struct Session
+    {
+        SessionConfig config;
+        std::unique_ptr<Network> network;
+        std::array<std::unique_ptr<HostStream>, MAX_STREAMS> streams;
+        std::array<std::atomic<bool>, MAX_STREAMS> active{};
+    };
+
+    void supervise(Session& session);
+    void runStream(Session& session, uint8_t streamId);
+    void schedule(std::chrono::steady_clock::time_point due, WorkerPool::Task task);
+    void chainEnded();
+
+private:
+    FrameSourceFactory sources_;
+    std::vector<MonitorInfo> monitors_;
+    CpuGovernor governor_;
+    mutable std::mutex sessions_mutex_;
+    std::vector<std::unique_ptr<Session>> sessions_;
+    std::atomic<bool> running_{ true };
+    std::mutex chains_mutex_;
+    std::condition_variable chains_cv_;
+    size_t chains_ = 0;
+    // Declared last, so it is destroyed first and its threads stop before the sessions go.
+    WorkerPool pool_;
+};
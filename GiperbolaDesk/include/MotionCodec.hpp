@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+constexpr int MOTION_BLOCK = 32;
+constexpr int MOTION_RANGE = 24;
+constexpr int MOTION_SCALE = 4;
+constexpr int RESIDUAL_SCALE = 2;
+constexpr int CHANGED_BLOCK = 64;
+
+struct MotionField
+{
+    int blockSize = MOTION_BLOCK;
+    int cols = 0;
+    int rows = 0;
+    std::vector<int8_t> vectors;
+
+    int dx(int col, int row) const { return vectors[(static_cast<size_t>(row) * cols + col) * 2]; }
+    int dy(int col, int row) const { return vectors[(static_cast<size_t>(row) * cols + col) * 2 + 1]; }
+};
+
+
+// MotionCodec
+
+// Block motion compensation for high-motion content. estimate() finds one vector per
+// MOTION_BLOCK block: a coarse global search on a MOTION_SCALE-times smaller image
+// seeds every block, which then refines from the best of zero, global and its already
+// decided neighbours. predict() and reconstruct() work on any 3- or 4-channel image so
+// the encoder (BGR) and the viewer canvas (RGBA) run the same arithmetic; the residual
+// is halved and offset by 128 so it survives JPEG in a single byte per channel.
+
+class MotionCodec
+{
+public:
+    static MotionField estimate(const cv::Mat& reference, const cv::Mat& frame);
+    static void predict(const cv::Mat& reference, const MotionField& field, cv::Mat& prediction);
+    static void residual(const cv::Mat& frame, const cv::Mat& prediction, cv::Mat& out);
+    static void reconstruct(cv::Mat& prediction, const cv::Mat& residual);
+    static double changed_ratio(const cv::Mat& previous, const cv::Mat& current, std::vector<uint8_t>* blocks = nullptr);
+
+private:
+    static cv::Point globalMotion(const cv::Mat& reference, const cv::Mat& frame);
+    static uint32_t blockCost(const cv::Mat& reference, const cv::Mat& frame, const cv::Rect& block, int dx, int dy);
+};
@@ -1,41 +1,206 @@
 #pragma once
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "Socket.hpp"
 #include <string>
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <atomic>
-#include <map>
-#include <queue>
+#include <array>
+#include <bitset>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <unordered_map>
 #include "Protocol.hpp"
+#include "SpscQueue.hpp"
+#include "Stats.hpp"
+#include "Transport.hpp"
+#include "FrameCodec.hpp"
+#include "Trace.hpp"
 
-#pragma comment(lib, "ws2_32.lib")
+struct NetworkStats
+{
+    uint64_t framesReceived = 0;
+    uint64_t framesDisplayed = 0;
+    uint64_t framesIncomplete = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t chunksReceived = 0;
+    uint64_t chunksLost = 0;
+    uint64_t queueDepth = 0;
+    uint64_t inputPackets = 0;
+    uint64_t inputEvents = 0;
+    uint64_t inputMerged = 0;
+    uint64_t inputDropped = 0;
+    uint64_t sessions = 0;
+    uint64_t sessionsRejected = 0;
+    int64_t latencyUs = -1;
+    int64_t rttUs = -1;
+};
+
+struct NetworkCounters
+{
+    std::atomic<uint64_t> framesReceived{ 0 };
+    std::atomic<uint64_t> framesDisplayed{ 0 };
+    std::atomic<uint64_t> framesIncomplete{ 0 };
+    std::atomic<uint64_t> bytesReceived{ 0 };
+    std::atomic<uint64_t> chunksReceived{ 0 };
+    std::atomic<uint64_t> chunksLost{ 0 };
+    std::atomic<uint64_t> queueDepth{ 0 };
+    std::atomic<uint64_t> inputPackets{ 0 };
+    std::atomic<uint64_t> inputEvents{ 0 };
+    std::atomic<uint64_t> inputMerged{ 0 };
+    std::atomic<uint64_t> inputDropped{ 0 };
+    std::atomic<uint64_t> sessionsRejected{ 0 };
+    std::atomic<int64_t> latencyUs{ -1 };
+};
+
+class ClockEstimator
+{
+public:
+    void add_sample(uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3);
+    bool synced() const;
+    int64_t offset_us() const;
+    int64_t rtt_us() const;
+    uint64_t to_local(uint64_t remoteTime) const;
 
-#undef min
-#undef max
+private:
+    struct Sample
+    {
+        int64_t offset;
+        int64_t rtt;
+    };
+
+    static constexpr size_t WINDOW = 8;
+
+    std::array<Sample, WINDOW> samples_{};
+    size_t count_ = 0;
+    std::atomic<bool> synced_{ false };
+    std::atomic<int64_t> offset_{ 0 };
+    std::atomic<int64_t> rtt_{ 0 };
+};
 
-#include "ScreenManager.hpp"
-#include <SFML/Graphics.hpp>
+constexpr const char* STATS_FILE = "desk_stats.txt";
+constexpr std::chrono::milliseconds STATS_INTERVAL{ 5000 };
+constexpr std::chrono::milliseconds CLOCK_SYNC_INTERVAL{ 1000 };
+constexpr const char* TRACE_ENV = "DESK_TRACE";
+constexpr const char* LOSSLESS_ENV = "DESK_LOSSLESS";
+constexpr std::chrono::milliseconds CACHE_ANNOUNCE_WAIT{ 300 };
+constexpr std::chrono::milliseconds CACHE_ANNOUNCE_INTERVAL{ 1000 };
+constexpr std::chrono::milliseconds KEYFRAME_REQUEST_INTERVAL{ 250 };
+constexpr const char* MONITORS_ENV = "DESK_MONITORS";
+constexpr size_t FRAME_QUEUE_DEPTH = 5;
+constexpr size_t SOCKET_BUFFER_SIZE = 4 * 1024 * 1024;
+constexpr size_t INPUT_QUEUE_SIZE = 1024;
+// Everything but frame chunks uses the next port up, like RTCP next to RTP.
+constexpr unsigned int CONTROL_PORT_OFFSET = 1;
+constexpr int CONTROL_DSCP = 46; // Expedited Forwarding
+constexpr int FRAME_DSCP = 34;   // AF41, interactive video
+constexpr std::chrono::milliseconds INJECT_IDLE_WAIT{ 5 };
+constexpr size_t MAX_SESSIONS = 16;
+constexpr std::chrono::seconds SESSION_TIMEOUT{ 10 };
+constexpr std::chrono::seconds SESSION_IDLE_TIMEOUT{ 1 };
+constexpr std::chrono::seconds SESSION_SWEEP_INTERVAL{ 1 };
+constexpr size_t SEQUENCE_WINDOW = 1024;
 
-struct ChunkHeader 
+// Parses a DESK_MONITORS value such as "0,2" or "all" into a stream bit mask; defaults to the primary.
+uint8_t parse_stream_mask(const char* value);
+
+class CpuGovernor;
+
+// Per-stream state. The first group belongs to the thread sending on the stream and the
+// second to the control thread; cache announcements are guarded by cache_mutex_, acks
+// by ack_mutex_ and the viewport by viewport_mutex_.
+struct StreamState
 {
-    const uint8_t magic = 0xAA;
-    uint32_t frameId;
-    uint16_t chunkIndex;
-    uint16_t totalChunks;
+    uint32_t frameId = 1;
+    uint32_t sequence = 0;
+    uint32_t cacheAnnounceId = 0;
+
+    uint32_t incomingAnnounceId = 0;
+    size_t incomingParts = 0;
+    std::vector<std::vector<CacheEntry>> incomingCache;
+    std::vector<bool> incomingSeen;
+    std::optional<std::vector<CacheEntry>> announcedCache;
+    std::vector<uint32_t> acks;
+    std::optional<cv::Rect> viewport;
+    std::atomic<bool> cacheRequested{ false };
+    std::atomic<bool> keyframeRequested{ false };
+    std::atomic<bool> active{ false };
 };
 
-struct FrameAssembly
+// A sender as the receive path sees it: the address and port chunks come from plus the
+// session ID the sender picked, so peers behind one address stay apart as well.
+struct SessionKey
 {
-    std::vector<std::vector<uint8_t>> chunks;
-    size_t receivedChunks = 0;
-    size_t totalChunks = 0;
+    uint32_t address = 0;
+    uint16_t port = 0;
+    uint32_t sessionId = 0;
+
+    bool operator==(const SessionKey& other) const
+    {
+        return address == other.address && port == other.port && sessionId == other.sessionId;
+    }
 };
 
-constexpr size_t CHUNK_DATA_SIZE = 1400;
+struct SessionKeyHash
+{
+    size_t operator()(const SessionKey& key) const
+    {
+        uint64_t endpoint = (static_cast<uint64_t>(key.address) << 16) | key.port;
+        return std::hash<uint64_t>()(endpoint ^ (static_cast<uint64_t>(key.sessionId) * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+// Reassembly state and counters of one sender. Only the receive thread touches the
+// streams; the counters are also read by stats() and sessions().
+struct PeerSession
+{
+    struct Stream
+    {
+        FrameAssembler assembler;
+        uint32_t expectedSequence = 0;
+        // Indexed by sequence % SEQUENCE_WINDOW over the last SEQUENCE_WINDOW sequences before
+        // expectedSequence: set while that chunk is counted lost.
+        std::bitset<SEQUENCE_WINDOW> missed;
+        bool sequenceStarted = false;
+    };
+
+    uint32_t id = 0;
+    SessionKey key;
+    std::atomic<uint64_t> lastSeen{ 0 };
+    std::array<Stream, MAX_STREAMS> streams;
+
+    std::atomic<uint64_t> framesReceived{ 0 };
+    std::atomic<uint64_t> framesIncomplete{ 0 };
+    std::atomic<uint64_t> bytesReceived{ 0 };
+    std::atomic<uint64_t> chunksReceived{ 0 };
+    std::atomic<uint64_t> chunksLost{ 0 };
+};
+
+struct SessionStats
+{
+    uint32_t id = 0;
+    std::string address;
+    unsigned int port = 0;
+    uint32_t sessionId = 0;
+    uint64_t framesReceived = 0;
+    uint64_t framesIncomplete = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t chunksReceived = 0;
+    uint64_t chunksLost = 0;
+};
+
+// Events on their way from the receive thread to the injection thread.
+struct QueuedInput
+{
+    EventPacket event;
+    uint64_t receivedAt = 0;
+};
+
+// Applies one received event on the host; the default is commitEvent.
+using InputInjector = std::function<void(EventType, const EventPayload&)>;
 
 class Network
 {
@@ -44,31 +209,111 @@ public:
     ~Network();
 
 public:
+#ifdef _WIN32
     void start(bool demonstration, const std::string& local_ip, unsigned int local_port,
         const std::string& ip_recipient, unsigned int port_recipient);
+#endif
+    void open(const std::string& local_ip, unsigned int local_port,
+        const std::string& ip_recipient, unsigned int port_recipient);
     void stop();
+    bool sendFrame(const FrameBuffer& frame, uint64_t captureTime, uint8_t streamId = 0);
+    uint32_t next_frame_id(uint8_t streamId = 0) const;
+    // The session ID this end stamps on its chunks; picked anew by every open().
+    uint32_t session_id() const;
     bool send_event(EventType event, const EventPayload& payload);
+    // Collects events until flush_events() sends them as one datagram; call that once per poll cycle.
+    bool queue_event(EventType event, const EventPayload& payload);
+    bool flush_events();
+    // Replaces the OS input injection; set it before open().
+    void set_input_injector(InputInjector injector);
+    std::optional<ReceivedFrame> get_frame();
+    void frame_presented(const ReceivedFrame& frame);
+    NetworkStats stats() const;
+    // Senders currently in the receive session table, oldest first.
+    std::vector<SessionStats> sessions() const;
+    // False once the session sent nothing for SESSION_IDLE_TIMEOUT; a viewer showing one
+    // host keeps to the session of its first frame while this holds.
+    bool session_active(uint32_t session) const;
+    bool sync_clock();
+    bool request_tile_cache(uint8_t streamId = 0);
+    bool tile_cache_requested(uint8_t streamId = 0);
+    bool send_tile_cache(const std::vector<CacheEntry>& entries, uint8_t streamId = 0);
+    std::optional<std::vector<CacheEntry>> take_tile_cache(uint8_t streamId = 0);
+    bool request_keyframe(uint32_t lastFrameId, uint8_t streamId = 0);
+    bool keyframe_requested(uint8_t streamId = 0);
+    bool ack_frame(uint32_t frameId, uint8_t streamId = 0);
+    // Swaps the pending acks into acks, so both vectors keep their capacity between frames.
+    void take_acks(std::vector<uint32_t>& acks, uint8_t streamId = 0);
+    bool subscribe(uint8_t streams);
+    uint8_t subscribed_streams() const;
+    void set_monitors(const std::vector<MonitorInfo>& monitors);
+    MonitorInfo monitor(uint8_t streamId) const;
+    bool send_viewport(const cv::Rect& area, uint8_t streamId = 0);
+    std::optional<cv::Rect> take_viewport(uint8_t streamId = 0);
 
 private:
     void init(const std::string& local_ip, unsigned int local_port);
-    bool sendFrame(const std::vector<uint8_t>& frame);
     void startReceiving();
     void stopReceiving();
     void receiveLoop();
+    void controlLoop();
     void handleChunk(const ChunkHeader& header, const uint8_t* data, size_t dataSize, const sockaddr_in& senderAddr);
+    PeerSession* findSession(const SessionKey& key, uint64_t now);
+    void expireSessions(uint64_t now);
+    void trackSequence(PeerSession& session, PeerSession::Stream& stream, uint32_t sequence);
     void handleEvent(const uint8_t* data, size_t size, const sockaddr_in& senderAddr);
-    void pushFrame(std::vector<uint8_t>&& frame);
+    void handleInput(const uint8_t* data, size_t size);
+    void enqueueInput(const EventPacket& event);
+    void injectLoop();
+    bool flushLocked();
+    void handleClock(const uint8_t* data, size_t size, const sockaddr_in& senderAddr, uint64_t receivedAt);
+    void handleCache(const uint8_t* data, size_t size);
+    void handleStreams(const uint8_t* data, size_t size, const sockaddr_in& senderAddr);
+#ifdef _WIN32
+    void streamMonitor(const MonitorInfo& monitor, uint8_t streamId, CpuGovernor* governor);
+#endif
+    void pushFrame(ReceivedFrame&& frame);
     void commitEvent(EventType event, const EventPayload& payload);
-    std::optional<std::vector<uint8_t>> get_frame();
 
 private:
-    SOCKET socket_;
+    SOCKET socket_ = INVALID_SOCKET;
+    SOCKET control_ = INVALID_SOCKET;
     sockaddr_in localAddr_;
+    sockaddr_in remoteAddr_{};
+    sockaddr_in controlAddr_{};
+    bool remoteValid_ = false;
+    bool opened_ = false;
+    // Held through stop(), so a second caller returns only once the threads are gone.
+    std::mutex stop_mutex_;
     std::thread recvThread_;
+    std::thread controlThread_;
+    std::thread injectThread_;
     std::atomic<bool> running_;
-    std::map<uint32_t, FrameAssembly> frames_progress_;
+    std::array<StreamState, MAX_STREAMS> streams_;
+    uint32_t sessionId_ = 0;
+    // Written by the receive thread only, which therefore reads it without the lock.
+    std::unordered_map<SessionKey, std::unique_ptr<PeerSession>, SessionKeyHash> sessions_;
+    mutable std::mutex sessions_mutex_;
+    PeerSession* lastSession_ = nullptr;
+    uint32_t nextSession_ = 1;
+    uint64_t lastExpiry_ = 0;
     std::mutex frame_mutex_;
-    std::queue<std::vector<uint8_t>> frame_queue_;
+    std::vector<ReceivedFrame> frame_queue_;
+    ClockEstimator clock_;
+    NetworkCounters counters_;
+    std::mutex cache_mutex_;
+    std::mutex ack_mutex_;
+    std::mutex viewport_mutex_;
+    std::atomic<uint8_t> subscribed_{ 1 };
+    mutable std::mutex monitor_mutex_;
+    std::vector<MonitorInfo> monitors_;
+    std::mutex input_mutex_;
+    InputBatchPacket input_;
+    SpscQueue<QueuedInput, INPUT_QUEUE_SIZE> input_queue_;
+    std::mutex inject_mutex_;
+    std::condition_variable inject_cv_;
+    std::atomic<bool> injectWaiting_{ false };
+    InputInjector injector_;
 
     std::string local_ip, ip_recipient;
     unsigned int local_port, port_recipient;
@@ -1,6 +1,702 @@
 #pragma once
 #include <iostream>
 #include <variant>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+constexpr uint8_t CHUNK_MAGIC = 0xAA;
+constexpr uint8_t EVENT_MAGIC = 0xBB;
+constexpr uint8_t CLOCK_MAGIC = 0xCC;
+constexpr uint8_t CACHE_MAGIC = 0xDD;
+constexpr uint8_t KEYFRAME_MAGIC = 0xEE;
+constexpr uint8_t ACK_MAGIC = 0xAB;
+constexpr uint8_t STREAM_MAGIC = 0xAC;
+constexpr uint8_t VIEWPORT_MAGIC = 0xAE;
+constexpr uint8_t INPUT_MAGIC = 0xBA;
+constexpr uint8_t PROTOCOL_VERSION = 6;
+constexpr size_t MAX_STREAMS = 8;
+// A raw 4K RGBA frame: the most the transport carries and a frame update may cover.
+constexpr size_t MAX_FRAME_BYTES = 32 * 1024 * 1024;
+constexpr uint16_t MAX_FRAME_SIDE = 8192;
+
+inline uint64_t monotonic_us()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline void put_be(uint8_t* out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+    }
+}
+
+inline uint64_t get_be(const uint8_t* in, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// LEB128 varints of zigzag-mapped signed values: small deltas of either sign take one byte.
+inline void put_varint(uint8_t*& out, int32_t value)
+{
+    uint32_t bits = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    while (bits >= 0x80) {
+        *out++ = static_cast<uint8_t>(bits | 0x80);
+        bits >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(bits);
+}
+
+inline bool get_varint(const uint8_t*& in, const uint8_t* end, int32_t& value)
+{
+    uint32_t bits = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (in == end) return false;
+        uint8_t byte = *in++;
+        bits |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            value = static_cast<int32_t>(bits >> 1) ^ -static_cast<int32_t>(bits & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// ChunkHeader
+
+// Wire layout (big-endian):
+// magic u8 | version u8 | streamId u8 | sessionId u32 | frameId u32 | chunkIndex u16 | totalChunks u16 | sequence u32 | captureTime u64
+// streamId is the monitor the frame shows; frameId and sequence count separately per stream.
+// sessionId is picked by the sender at startup, so a restarted host is a new session to the viewer.
+// captureTime is the sender's monotonic clock in microseconds; sequence counts every chunk datagram.
+
+struct ChunkHeader
+{
+    static constexpr size_t SIZE = 27;
+
+    uint8_t magic = CHUNK_MAGIC;
+    uint8_t version = PROTOCOL_VERSION;
+    uint8_t streamId = 0;
+    uint32_t sessionId = 0;
+    uint32_t frameId = 0;
+    uint16_t chunkIndex = 0;
+    uint16_t totalChunks = 0;
+    uint32_t sequence = 0;
+    uint64_t captureTime = 0;
+
+    void write(uint8_t* out) const
+    {
+        out[0] = magic;
+        out[1] = version;
+        out[2] = streamId;
+        put_be(out + 3, sessionId, 4);
+        put_be(out + 7, frameId, 4);
+        put_be(out + 11, chunkIndex, 2);
+        put_be(out + 13, totalChunks, 2);
+        put_be(out + 15, sequence, 4);
+        put_be(out + 19, captureTime, 8);
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < SIZE || data[0] != CHUNK_MAGIC || data[1] != PROTOCOL_VERSION || data[2] >= MAX_STREAMS) {
+            return false;
+        }
+
+        magic = data[0];
+        version = data[1];
+        streamId = data[2];
+        sessionId = static_cast<uint32_t>(get_be(data + 3, 4));
+        frameId = static_cast<uint32_t>(get_be(data + 7, 4));
+        chunkIndex = static_cast<uint16_t>(get_be(data + 11, 2));
+        totalChunks = static_cast<uint16_t>(get_be(data + 13, 2));
+        sequence = static_cast<uint32_t>(get_be(data + 15, 4));
+        captureTime = get_be(data + 19, 8);
+        return true;
+    }
+};
+
+
+// ClockSyncPacket
+
+// NTP-style exchange: the viewer sends t0, the host answers with t0, its receive
+// time t1 and its send time t2; the viewer stamps t3 on arrival.
+
+enum class ClockMessage : uint8_t
+{
+    Request = 0x01,
+    Reply = 0x02
+};
+
+struct ClockSyncPacket
+{
+    static constexpr size_t SIZE = 27;
+
+    ClockMessage type = ClockMessage::Request;
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
+    uint64_t t2 = 0;
+
+    void write(uint8_t* out) const
+    {
+        out[0] = CLOCK_MAGIC;
+        out[1] = PROTOCOL_VERSION;
+        out[2] = static_cast<uint8_t>(type);
+        put_be(out + 3, t0, 8);
+        put_be(out + 11, t1, 8);
+        put_be(out + 19, t2, 8);
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < SIZE || data[0] != CLOCK_MAGIC || data[1] != PROTOCOL_VERSION) {
+            return false;
+        }
+
+        type = static_cast<ClockMessage>(data[2]);
+        t0 = get_be(data + 3, 8);
+        t1 = get_be(data + 11, 8);
+        t2 = get_be(data + 19, 8);
+        return true;
+    }
+};
+
+
+// KeyframeRequestPacket
+
+// Sent by the viewer when an update no longer applies to what it shows, so the host
+// starts over with a keyframe instead of waiting for the next scheduled one:
+// magic u8 | version u8 | streamId u8 | frameId u32 (the last frame the viewer applied)
+
+struct KeyframeRequestPacket
+{
+    static constexpr size_t SIZE = 7;
+
+    uint8_t streamId = 0;
+    uint32_t frameId = 0;
+
+    void write(uint8_t* out) const
+    {
+        out[0] = KEYFRAME_MAGIC;
+        out[1] = PROTOCOL_VERSION;
+        out[2] = streamId;
+        put_be(out + 3, frameId, 4);
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < SIZE || data[0] != KEYFRAME_MAGIC || data[1] != PROTOCOL_VERSION || data[2] >= MAX_STREAMS) {
+            return false;
+        }
+
+        streamId = data[2];
+        frameId = static_cast<uint32_t>(get_be(data + 3, 4));
+        return true;
+    }
+};
+
+
+// FrameAckPacket
+
+// Sent by the viewer for every update it applied, so the host knows which tiles it
+// holds without waiting for the next cache announcement:
+// magic u8 | version u8 | streamId u8 | frameId u32
+
+struct FrameAckPacket
+{
+    static constexpr size_t SIZE = 7;
+
+    uint8_t streamId = 0;
+    uint32_t frameId = 0;
+
+    void write(uint8_t* out) const
+    {
+        out[0] = ACK_MAGIC;
+        out[1] = PROTOCOL_VERSION;
+        out[2] = streamId;
+        put_be(out + 3, frameId, 4);
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < SIZE || data[0] != ACK_MAGIC || data[1] != PROTOCOL_VERSION || data[2] >= MAX_STREAMS) {
+            return false;
+        }
+
+        streamId = data[2];
+        frameId = static_cast<uint32_t>(get_be(data + 3, 4));
+        return true;
+    }
+};
+
+
+// StreamListPacket
+
+// Every monitor of the host is a separate stream, numbered with the primary first.
+// The viewer subscribes with the streams it wants; the host answers with the same set
+// and the layout of all its monitors in virtual-screen coordinates:
+// magic u8 | version u8 | type u8 | subscribed u8 (bit per stream) | count u8 | (x i32, y i32, width u16, height u16, primary u8) x count
+
+enum class StreamMessage : uint8_t
+{
+    Subscribe = 0x01,
+    Layout = 0x02
+};
+
+struct MonitorInfo
+{
+    static constexpr size_t SIZE = 13;
+
+    int32_t x = 0;
+    int32_t y = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    bool primary = false;
+};
+
+struct StreamListPacket
+{
+    static constexpr size_t HEADER_SIZE = 5;
+
+    StreamMessage type = StreamMessage::Subscribe;
+    uint8_t subscribed = 1;
+    std::vector<MonitorInfo> monitors;
+
+    size_t size() const
+    {
+        return HEADER_SIZE + monitors.size() * MonitorInfo::SIZE;
+    }
+
+    void write(uint8_t* out) const
+    {
+        out[0] = STREAM_MAGIC;
+        out[1] = PROTOCOL_VERSION;
+        out[2] = static_cast<uint8_t>(type);
+        out[3] = subscribed;
+        out[4] = static_cast<uint8_t>(monitors.size());
+
+        uint8_t* p = out + HEADER_SIZE;
+        for (auto& monitor : monitors) {
+            put_be(p, static_cast<uint32_t>(monitor.x), 4);
+            put_be(p + 4, static_cast<uint32_t>(monitor.y), 4);
+            put_be(p + 8, monitor.width, 2);
+            put_be(p + 10, monitor.height, 2);
+            p[12] = monitor.primary ? 1 : 0;
+            p += MonitorInfo::SIZE;
+        }
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < HEADER_SIZE || data[0] != STREAM_MAGIC || data[1] != PROTOCOL_VERSION) {
+            return false;
+        }
+
+        type = static_cast<StreamMessage>(data[2]);
+        subscribed = data[3];
+        size_t count = data[4];
+        if (count > MAX_STREAMS || size < HEADER_SIZE + count * MonitorInfo::SIZE) {
+            return false;
+        }
+
+        monitors.resize(count);
+        const uint8_t* p = data + HEADER_SIZE;
+        for (auto& monitor : monitors) {
+            monitor.x = static_cast<int32_t>(static_cast<uint32_t>(get_be(p, 4)));
+            monitor.y = static_cast<int32_t>(static_cast<uint32_t>(get_be(p + 4, 4)));
+            monitor.width = static_cast<uint16_t>(get_be(p + 8, 2));
+            monitor.height = static_cast<uint16_t>(get_be(p + 10, 2));
+            monitor.primary = p[12] != 0;
+            p += MonitorInfo::SIZE;
+        }
+        return true;
+    }
+};
+
+
+// ViewportPacket
+
+// The part of a stream the viewer currently shows after zooming and panning, in frame
+// pixels; width = 0 means the whole frame:
+// magic u8 | version u8 | streamId u8 | x u16 | y u16 | width u16 | height u16
+
+struct ViewportPacket
+{
+    static constexpr size_t SIZE = 11;
+
+    uint8_t streamId = 0;
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+
+    void write(uint8_t* out) const
+    {
+        out[0] = VIEWPORT_MAGIC;
+        out[1] = PROTOCOL_VERSION;
+        out[2] = streamId;
+        put_be(out + 3, x, 2);
+        put_be(out + 5, y, 2);
+        put_be(out + 7, width, 2);
+        put_be(out + 9, height, 2);
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < SIZE || data[0] != VIEWPORT_MAGIC || data[1] != PROTOCOL_VERSION || data[2] >= MAX_STREAMS) {
+            return false;
+        }
+
+        streamId = data[2];
+        x = static_cast<uint16_t>(get_be(data + 3, 2));
+        y = static_cast<uint16_t>(get_be(data + 5, 2));
+        width = static_cast<uint16_t>(get_be(data + 7, 2));
+        height = static_cast<uint16_t>(get_be(data + 9, 2));
+        return true;
+    }
+};
+
+
+// FrameUpdate
+
+// Payload of a reassembled frame (big-endian):
+// baseFrameId u32 | width u16 | height u16 | rectCount u16, then for every rect
+// encoding u8 | x u16 | y u16 | width u16 | height u16 | CopyRect:   srcX u16 | srcY u16
+//                                                      | Jpeg:       size u32 | data
+//                                                      | TileJpeg:   count u16 | hash x count | size u32 | data
+//                                                      | CachedTile: hash
+//                                                      | Palette, Qoi:         as Jpeg
+//                                                      | TilePalette, TileQoi: as TileJpeg
+//                                                      | Motion:     blockSize u8 | (dx i8, dy i8) x blocks | size u32 | data
+// A baseFrameId of 0 marks a frame that does not depend on the previous one; otherwise
+// the rects only make sense on top of that frame and the viewer drops the update if it
+// shows another one. TileJpeg is a horizontal run of TILE_SIZE tiles that both ends add
+// to their tile cache in order; CachedTile draws a tile the viewer already holds.
+// The Palette and Qoi variants carry that lossless codec's data (see Codec) instead of JPEG.
+// Motion moves every blockSize block of the rect by its vector, reading the rect as the
+// previous frame left it, and adds the JPEG-coded residual on top (see MotionCodec).
+
+enum class RectEncoding : uint8_t
+{
+    Jpeg = 0x01,
+    CopyRect = 0x02,
+    TileJpeg = 0x03,
+    CachedTile = 0x04,
+    Palette = 0x05,
+    TilePalette = 0x06,
+    Qoi = 0x07,
+    TileQoi = 0x08,
+    Motion = 0x09
+};
+
+struct TileHash
+{
+    static constexpr size_t SIZE = 16;
+
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const TileHash& other) const { return lo == other.lo && hi == other.hi; }
+
+    void write(uint8_t* out) const
+    {
+        put_be(out, hi, 8);
+        put_be(out + 8, lo, 8);
+    }
+
+    void read(const uint8_t* data)
+    {
+        hi = get_be(data, 8);
+        lo = get_be(data + 8, 8);
+    }
+};
+
+struct UpdateRect
+{
+    RectEncoding encoding = RectEncoding::Jpeg;
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint16_t srcX = 0;
+    uint16_t srcY = 0;
+    uint8_t blockSize = 0;
+    std::vector<TileHash> hashes;
+    std::vector<int8_t> vectors;
+    std::vector<uint8_t> data;
+
+    size_t block_count() const
+    {
+        if (blockSize == 0) return 0;
+        return static_cast<size_t>((width + blockSize - 1) / blockSize) * ((height + blockSize - 1) / blockSize);
+    }
+
+    size_t payload_size() const
+    {
+        switch (encoding) {
+        case RectEncoding::CopyRect:   return 4;
+        case RectEncoding::Jpeg:
+        case RectEncoding::Palette:
+        case RectEncoding::Qoi:        return 4 + data.size();
+        case RectEncoding::TileJpeg:
+        case RectEncoding::TilePalette:
+        case RectEncoding::TileQoi:    return 2 + hashes.size() * TileHash::SIZE + 4 + data.size();
+        case RectEncoding::CachedTile: return TileHash::SIZE;
+        case RectEncoding::Motion:     return 1 + vectors.size() + 4 + data.size();
+        default:                       return 0;
+        }
+    }
+};
+
+struct FrameUpdate
+{
+    static constexpr size_t HEADER_SIZE = 10;
+    static constexpr size_t RECT_SIZE = 9;
+
+    uint32_t baseFrameId = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    std::vector<UpdateRect> rects;
+
+    size_t size() const
+    {
+        size_t size = HEADER_SIZE;
+        for (auto& rect : rects) {
+            size += RECT_SIZE + rect.payload_size();
+        }
+        return size;
+    }
+
+    void write(uint8_t* out) const
+    {
+        uint8_t* p = out;
+        put_be(p, baseFrameId, 4);
+        put_be(p + 4, width, 2);
+        put_be(p + 6, height, 2);
+        put_be(p + 8, rects.size(), 2);
+        p += HEADER_SIZE;
+
+        for (auto& rect : rects) {
+            p[0] = static_cast<uint8_t>(rect.encoding);
+            put_be(p + 1, rect.x, 2);
+            put_be(p + 3, rect.y, 2);
+            put_be(p + 5, rect.width, 2);
+            put_be(p + 7, rect.height, 2);
+            p += RECT_SIZE;
+
+            switch (rect.encoding) {
+            case RectEncoding::CopyRect:
+                put_be(p, rect.srcX, 2);
+                put_be(p + 2, rect.srcY, 2);
+                p += 4;
+                break;
+            case RectEncoding::CachedTile:
+                rect.hashes.front().write(p);
+                p += TileHash::SIZE;
+                break;
+            case RectEncoding::TileJpeg:
+            case RectEncoding::TilePalette:
+            case RectEncoding::TileQoi:
+                put_be(p, rect.hashes.size(), 2);
+                p += 2;
+                for (auto& hash : rect.hashes) {
+                    hash.write(p);
+                    p += TileHash::SIZE;
+                }
+                [[fallthrough]];
+            default:
+                if (rect.encoding == RectEncoding::Motion) {
+                    *p++ = rect.blockSize;
+                    std::memcpy(p, rect.vectors.data(), rect.vectors.size());
+                    p += rect.vectors.size();
+                }
+                put_be(p, rect.data.size(), 4);
+                std::copy(rect.data.begin(), rect.data.end(), p + 4);
+                p += 4 + rect.data.size();
+                break;
+            }
+        }
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < HEADER_SIZE) return false;
+
+        baseFrameId = static_cast<uint32_t>(get_be(data, 4));
+        width = static_cast<uint16_t>(get_be(data + 4, 2));
+        height = static_cast<uint16_t>(get_be(data + 6, 2));
+        // The size comes from whoever sent the datagram; the viewer allocates its canvas by it.
+        if (width > MAX_FRAME_SIDE || height > MAX_FRAME_SIDE ||
+            static_cast<size_t>(width) * height * 4 > MAX_FRAME_BYTES) {
+            return false;
+        }
+        rects.resize(static_cast<size_t>(get_be(data + 8, 2)));
+
+        size_t offset = HEADER_SIZE;
+        auto available = [&](size_t bytes) { return size - offset >= bytes; };
+
+        for (auto& rect : rects) {
+            if (!available(RECT_SIZE)) return false;
+
+            const uint8_t* p = data + offset;
+            rect.encoding = static_cast<RectEncoding>(p[0]);
+            rect.x = static_cast<uint16_t>(get_be(p + 1, 2));
+            rect.y = static_cast<uint16_t>(get_be(p + 3, 2));
+            rect.width = static_cast<uint16_t>(get_be(p + 5, 2));
+            rect.height = static_cast<uint16_t>(get_be(p + 7, 2));
+            offset += RECT_SIZE;
+            rect.hashes.clear();
+            rect.vectors.clear();
+            rect.data.clear();
+
+            switch (rect.encoding) {
+            case RectEncoding::CopyRect:
+                if (!available(4)) return false;
+                rect.srcX = static_cast<uint16_t>(get_be(data + offset, 2));
+                rect.srcY = static_cast<uint16_t>(get_be(data + offset + 2, 2));
+                offset += 4;
+                break;
+            case RectEncoding::CachedTile:
+                if (!available(TileHash::SIZE)) return false;
+                rect.hashes.resize(1);
+                rect.hashes[0].read(data + offset);
+                offset += TileHash::SIZE;
+                break;
+            case RectEncoding::TileJpeg:
+            case RectEncoding::TilePalette:
+            case RectEncoding::TileQoi: {
+                if (!available(2)) return false;
+                size_t count = static_cast<size_t>(get_be(data + offset, 2));
+                offset += 2;
+                if (!available(count * TileHash::SIZE)) return false;
+                rect.hashes.resize(count);
+                for (auto& hash : rect.hashes) {
+                    hash.read(data + offset);
+                    offset += TileHash::SIZE;
+                }
+            }
+                [[fallthrough]];
+            case RectEncoding::Motion:
+                if (rect.encoding == RectEncoding::Motion) {
+                    if (!available(1)) return false;
+                    rect.blockSize = data[offset++];
+                    size_t bytes = rect.block_count() * 2;
+                    if (bytes == 0 || !available(bytes)) return false;
+                    rect.vectors.assign(reinterpret_cast<const int8_t*>(data + offset),
+                        reinterpret_cast<const int8_t*>(data + offset + bytes));
+                    offset += bytes;
+                }
+                [[fallthrough]];
+            case RectEncoding::Jpeg:
+            case RectEncoding::Palette:
+            case RectEncoding::Qoi: {
+                if (!available(4)) return false;
+                size_t length = static_cast<size_t>(get_be(data + offset, 4));
+                offset += 4;
+                if (!available(length)) return false;
+                rect.data.assign(data + offset, data + offset + length);
+                offset += length;
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+// CacheAnnouncePacket
+
+// The host asks with parts = 0; the viewer answers with the tiles it holds, oldest
+// first, split over as many datagrams as needed (big-endian):
+// magic u8 | version u8 | streamId u8 | announceId u32 | part u16 | parts u16 | count u16 | (hash, cost u32, exact u8) x count
+// exact is 1 when the stored pixels came from a lossless encoding. Every stream has its own cache.
+
+struct CacheEntry
+{
+    static constexpr size_t SIZE = TileHash::SIZE + 5;
+
+    TileHash hash;
+    uint32_t cost = 0;
+    bool exact = false;
+};
+
+struct CacheAnnouncePacket
+{
+    static constexpr size_t HEADER_SIZE = 13;
+    static constexpr size_t MAX_ENTRIES = 64;
+
+    uint8_t streamId = 0;
+    uint32_t announceId = 0;
+    uint16_t part = 0;
+    uint16_t parts = 0;
+    std::vector<CacheEntry> entries;
+
+    size_t size() const
+    {
+        return HEADER_SIZE + entries.size() * CacheEntry::SIZE;
+    }
+
+    void write(uint8_t* out) const
+    {
+        out[0] = CACHE_MAGIC;
+        out[1] = PROTOCOL_VERSION;
+        out[2] = streamId;
+        put_be(out + 3, announceId, 4);
+        put_be(out + 7, part, 2);
+        put_be(out + 9, parts, 2);
+        put_be(out + 11, entries.size(), 2);
+
+        uint8_t* p = out + HEADER_SIZE;
+        for (auto& entry : entries) {
+            entry.hash.write(p);
+            put_be(p + TileHash::SIZE, entry.cost, 4);
+            p[TileHash::SIZE + 4] = entry.exact ? 1 : 0;
+            p += CacheEntry::SIZE;
+        }
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < HEADER_SIZE || data[0] != CACHE_MAGIC || data[1] != PROTOCOL_VERSION || data[2] >= MAX_STREAMS) {
+            return false;
+        }
+
+        streamId = data[2];
+        announceId = static_cast<uint32_t>(get_be(data + 3, 4));
+        part = static_cast<uint16_t>(get_be(data + 7, 2));
+        parts = static_cast<uint16_t>(get_be(data + 9, 2));
+        size_t count = static_cast<size_t>(get_be(data + 11, 2));
+        if (count > MAX_ENTRIES || size < HEADER_SIZE + count * CacheEntry::SIZE) {
+            return false;
+        }
+
+        entries.resize(count);
+        const uint8_t* p = data + HEADER_SIZE;
+        for (auto& entry : entries) {
+            entry.hash.read(p);
+            entry.cost = static_cast<uint32_t>(get_be(p + TileHash::SIZE, 4));
+            entry.exact = p[TileHash::SIZE + 4] != 0;
+            p += CacheEntry::SIZE;
+        }
+        return true;
+    }
+};
+
+
+// Events
 
 enum class EventType : uint8_t
 {
@@ -22,4 +718,362 @@ using EventPayload = std::variant<
     MouseClickData,
     MouseWheelData,
     KeyPressData
->;
\ No newline at end of file
+>;
+
+
+// EventPacket
+
+// magic u8 | type u8 | payloadSize u8 | fields (little-endian i16 each)
+// Every payload type lists its fields once in EventLayout and every event type names its
+// payload in EventData; the encoder, the decoder and the sizes are generated from those
+// lists, so the two ends cannot disagree about where a field is. Each field also names
+// the channel its value is delta-coded against inside an InputBatchPacket.
+
+enum class EventChannel : uint8_t
+{
+    X,
+    Y,
+    Wheel,
+    Key,
+    Count
+};
+
+constexpr size_t EVENT_CHANNELS = static_cast<size_t>(EventChannel::Count);
+
+template <auto Member, EventChannel Channel>
+struct EventField
+{
+    static constexpr size_t SIZE = 2;
+    static constexpr size_t MAX_DELTA_SIZE = 3;
+    static constexpr size_t CHANNEL = static_cast<size_t>(Channel);
+
+    template <typename T>
+    static void write(const T& event, uint8_t* out)
+    {
+        const uint16_t value = static_cast<uint16_t>(event.*Member);
+        out[0] = static_cast<uint8_t>(value & 0xFF);
+        out[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    template <typename T>
+    static void read(T& event, const uint8_t* in)
+    {
+        event.*Member = static_cast<int16_t>(in[0] | (in[1] << 8));
+    }
+
+    // Values keep the 16-bit range of the fixed encoding, so a delta fits in three bytes.
+    template <typename T>
+    static void write_delta(const T& event, uint8_t*& out, int32_t* previous)
+    {
+        const int32_t value = static_cast<int16_t>(event.*Member);
+        put_varint(out, value - previous[CHANNEL]);
+        previous[CHANNEL] = value;
+    }
+
+    template <typename T>
+    static bool read_delta(T& event, const uint8_t*& in, const uint8_t* end, int32_t* previous)
+    {
+        int32_t delta;
+        if (!get_varint(in, end, delta)) return false;
+        const int32_t value = static_cast<int16_t>(previous[CHANNEL] + delta);
+        event.*Member = value;
+        previous[CHANNEL] = value;
+        return true;
+    }
+};
+
+template <typename... Fields>
+struct EventSchema
+{
+    static constexpr size_t SIZE = (Fields::SIZE + ... + 0);
+    static constexpr size_t MAX_DELTA_SIZE = (Fields::MAX_DELTA_SIZE + ... + 0);
+
+    template <typename T>
+    static void write(const T& event, uint8_t* out)
+    {
+        size_t offset = 0;
+        ((Fields::write(event, out + offset), offset += Fields::SIZE), ...);
+    }
+
+    template <typename T>
+    static void read(T& event, const uint8_t* in)
+    {
+        size_t offset = 0;
+        ((Fields::read(event, in + offset), offset += Fields::SIZE), ...);
+    }
+
+    template <typename T>
+    static void write_delta(const T& event, uint8_t*& out, int32_t* previous)
+    {
+        (Fields::write_delta(event, out, previous), ...);
+    }
+
+    template <typename T>
+    static bool read_delta(T& event, const uint8_t*& in, const uint8_t* end, int32_t* previous)
+    {
+        return (Fields::read_delta(event, in, end, previous) && ...);
+    }
+};
+
+template <typename T>
+struct EventLayout;
+
+template <>
+struct EventLayout<MouseMoveData>
+    : EventSchema<EventField<&MouseMoveData::x, EventChannel::X>, EventField<&MouseMoveData::y, EventChannel::Y>> { };
+
+template <>
+struct EventLayout<MouseClickData>
+    : EventSchema<EventField<&MouseClickData::x, EventChannel::X>, EventField<&MouseClickData::y, EventChannel::Y>> { };
+
+template <>
+struct EventLayout<MouseWheelData>
+    : EventSchema<EventField<&MouseWheelData::x, EventChannel::X>, EventField<&MouseWheelData::y, EventChannel::Y>,
+        EventField<&MouseWheelData::delta, EventChannel::Wheel>> { };
+
+template <>
+struct EventLayout<KeyPressData>
+    : EventSchema<EventField<&KeyPressData::keycode, EventChannel::Key>> { };
+
+template <EventType Type>
+struct EventData;
+
+template <> struct EventData<EventType::MouseMove> { using type = MouseMoveData; };
+template <> struct EventData<EventType::MouseLeftClick> { using type = MouseClickData; };
+template <> struct EventData<EventType::MouseRightClick> { using type = MouseClickData; };
+template <> struct EventData<EventType::MouseWheel> { using type = MouseWheelData; };
+template <> struct EventData<EventType::KeyPress> { using type = KeyPressData; };
+
+template <EventType... Types>
+struct EventTypeList { };
+
+using EventTypes = EventTypeList<
+    EventType::MouseMove,
+    EventType::MouseLeftClick,
+    EventType::MouseRightClick,
+    EventType::MouseWheel,
+    EventType::KeyPress
+>;
+
+template <EventType... Types>
+constexpr size_t max_event_payload(EventTypeList<Types...>)
+{
+    return std::max({ EventLayout<typename EventData<Types>::type>::SIZE... });
+}
+
+template <EventType... Types>
+constexpr size_t max_event_delta(EventTypeList<Types...>)
+{
+    return std::max({ EventLayout<typename EventData<Types>::type>::MAX_DELTA_SIZE... });
+}
+
+struct EventPacket
+{
+    static constexpr size_t HEADER_SIZE = 3;
+    static constexpr size_t MAX_SIZE = HEADER_SIZE + max_event_payload(EventTypes{});
+    static constexpr size_t MAX_DELTA_SIZE = 1 + max_event_delta(EventTypes{});
+
+    EventType type = EventType::MouseMove;
+    EventPayload payload;
+
+    // Returns the bytes written to out (at most MAX_SIZE), or 0 when the payload does not
+    // belong to the event type.
+    size_t write(uint8_t* out) const
+    {
+        return writeAny(out, EventTypes{});
+    }
+
+    bool read(const uint8_t* data, size_t size)
+    {
+        if (size < HEADER_SIZE || data[0] != EVENT_MAGIC) {
+            return false;
+        }
+        return readAny(data, size, EventTypes{});
+    }
+
+    // Batch form: type u8 | fields as varint deltas against previous, advancing out.
+    // Writes at most MAX_DELTA_SIZE bytes; false when the payload does not belong to the type.
+    bool write_delta(uint8_t*& out, int32_t* previous) const
+    {
+        return writeDeltaAny(out, previous, EventTypes{});
+    }
+
+    bool read_delta(const uint8_t*& in, const uint8_t* end, int32_t* previous)
+    {
+        if (in == end) return false;
+        const uint8_t kind = *in++;
+        return readDeltaAny(kind, in, end, previous, EventTypes{});
+    }
+
+private:
+    template <EventType... Types>
+    size_t writeAny(uint8_t* out, EventTypeList<Types...>) const
+    {
+        size_t written = 0;
+        (void)((type == Types && (written = writeAs<Types>(out)) != 0) || ...);
+        return written;
+    }
+
+    template <EventType Type>
+    size_t writeAs(uint8_t* out) const
+    {
+        using T = typename EventData<Type>::type;
+        const T* event = std::get_if<T>(&payload);
+        if (!event) return 0;
+
+        out[0] = EVENT_MAGIC;
+        out[1] = static_cast<uint8_t>(Type);
+        out[2] = static_cast<uint8_t>(EventLayout<T>::SIZE);
+        EventLayout<T>::write(*event, out + HEADER_SIZE);
+        return HEADER_SIZE + EventLayout<T>::SIZE;
+    }
+
+    template <EventType... Types>
+    bool readAny(const uint8_t* data, size_t size, EventTypeList<Types...>)
+    {
+        return ((data[1] == static_cast<uint8_t>(Types) && readAs<Types>(data, size)) || ...);
+    }
+
+    template <EventType Type>
+    bool readAs(const uint8_t* data, size_t size)
+    {
+        using T = typename EventData<Type>::type;
+        if (data[2] != EventLayout<T>::SIZE || size < HEADER_SIZE + EventLayout<T>::SIZE) {
+            return false;
+        }
+
+        T event{};
+        EventLayout<T>::read(event, data + HEADER_SIZE);
+        type = Type;
+        payload = event;
+        return true;
+    }
+
+    template <EventType... Types>
+    bool writeDeltaAny(uint8_t*& out, int32_t* previous, EventTypeList<Types...>) const
+    {
+        return ((type == Types && writeDeltaAs<Types>(out, previous)) || ...);
+    }
+
+    template <EventType Type>
+    bool writeDeltaAs(uint8_t*& out, int32_t* previous) const
+    {
+        using T = typename EventData<Type>::type;
+        const T* event = std::get_if<T>(&payload);
+        if (!event) return false;
+
+        *out++ = static_cast<uint8_t>(Type);
+        EventLayout<T>::write_delta(*event, out, previous);
+        return true;
+    }
+
+    template <EventType... Types>
+    bool readDeltaAny(uint8_t kind, const uint8_t*& in, const uint8_t* end, int32_t* previous, EventTypeList<Types...>)
+    {
+        return ((kind == static_cast<uint8_t>(Types) && readDeltaAs<Types>(in, end, previous)) || ...);
+    }
+
+    template <EventType Type>
+    bool readDeltaAs(const uint8_t*& in, const uint8_t* end, int32_t* previous)
+    {
+        using T = typename EventData<Type>::type;
+        T event{};
+        if (!EventLayout<T>::read_delta(event, in, end, previous)) return false;
+        type = Type;
+        payload = event;
+        return true;
+    }
+};
+
+
+// InputBatchPacket
+
+// All input events of one viewer poll cycle in a single datagram:
+// magic u8 | version u8 | count u8 | (type u8 | fields as zigzag varint deltas) x count
+// Every field is coded against the previous value on its channel (x, y, wheel, key) in the
+// same datagram, starting from 0, so a pointer path costs a byte or two per move and a
+// lost datagram does not throw off the next one.
+
+class InputBatchPacket
+{
+public:
+    static constexpr size_t HEADER_SIZE = 3;
+    static constexpr size_t MAX_SIZE = 512;
+    static constexpr size_t MAX_EVENTS = 255;
+
+public:
+    // False when the event does not fit; send the batch, clear() it and add again.
+    bool add(const EventPacket& event)
+    {
+        if (count_ == MAX_EVENTS || size_ + EventPacket::MAX_DELTA_SIZE > MAX_SIZE) {
+            return false;
+        }
+
+        uint8_t* out = bytes_ + size_;
+        if (!event.write_delta(out, previous_)) {
+            return false;
+        }
+        size_ = out - bytes_;
+        count_++;
+        return true;
+    }
+
+    void clear()
+    {
+        size_ = HEADER_SIZE;
+        count_ = 0;
+        std::fill(std::begin(previous_), std::end(previous_), 0);
+    }
+
+    bool empty() const
+    {
+        return count_ == 0;
+    }
+
+    size_t count() const
+    {
+        return count_;
+    }
+
+    // The finished datagram.
+    const uint8_t* data()
+    {
+        bytes_[0] = INPUT_MAGIC;
+        bytes_[1] = PROTOCOL_VERSION;
+        bytes_[2] = static_cast<uint8_t>(count_);
+        return bytes_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // Calls handle(const EventPacket&) for every event in order; stops and returns false
+    // at the first one that does not decode.
+    template <typename Handler>
+    static bool read(const uint8_t* data, size_t size, Handler&& handle)
+    {
+        if (size < HEADER_SIZE || data[0] != INPUT_MAGIC || data[1] != PROTOCOL_VERSION) {
+            return false;
+        }
+
+        int32_t previous[EVENT_CHANNELS] = {};
+        const uint8_t* in = data + HEADER_SIZE;
+        const uint8_t* end = data + size;
+        for (size_t i = 0; i < data[2]; i++) {
+            EventPacket event;
+            if (!event.read_delta(in, end, previous)) {
+                return false;
+            }
+            handle(event);
+        }
+        return true;
+    }
+
+private:
+    uint8_t bytes_[MAX_SIZE];
+    size_t size_ = HEADER_SIZE;
+    size_t count_ = 0;
+    int32_t previous_[EVENT_CHANNELS] = {};
+};
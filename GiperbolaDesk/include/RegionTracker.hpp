@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "MotionCodec.hpp"
+
+constexpr int VIDEO_ENTER_CHANGES = 12;
+constexpr uint16_t VIDEO_STAY_MASK = 0x000F;
+constexpr int VIDEO_MIN_BLOCKS = 4;
+constexpr size_t VIDEO_MAX_REGIONS = 4;
+
+
+// RegionTracker
+
+// Finds the parts of the screen that keep changing, such as an embedded video player.
+// Every CHANGED_BLOCK block remembers whether it changed in each of the last 16 scans;
+// blocks that changed in VIDEO_ENTER_CHANGES of them are hot, and blocks already inside
+// a region stay hot while they changed in any of the last four. Connected hot blocks
+// become one block-aligned rectangle; small and overlapping ones are dropped or merged.
+
+class RegionTracker
+{
+public:
+    const std::vector<cv::Rect>& update(const std::vector<uint8_t>& changed, const cv::Size& frameSize);
+    const std::vector<cv::Rect>& regions() const;
+    void reset();
+
+private:
+    bool inRegion(int col, int row) const;
+    void findRegions(const std::vector<uint8_t>& hot, const cv::Size& frameSize);
+
+private:
+    int cols_ = 0;
+    int rows_ = 0;
+    std::vector<uint16_t> history_;
+    std::vector<cv::Rect> regions_;
+};
@@ -1,29 +1,56 @@
 #pragma once
 #include <vector>
 #include <fstream>
+#include <algorithm>
 #include <windows.h>
 #include <opencv2/opencv.hpp>
+#include "Codec.hpp"
+#include "Protocol.hpp"
+#include "Stats.hpp"
 
 class ScreenManager
 {
 public:
     static std::vector<uint8_t> capture_screen_as_jpg(int quality = 85)
     {
-        int width = GetSystemMetrics(SM_CXSCREEN);
-        int height = GetSystemMetrics(SM_CYSCREEN);
+        return Codec::encode_jpg(capture_screen(), quality);
+    }
+
+    static cv::Mat capture_screen()
+    {
+        return capture_monitor(primary_monitor());
+    }
+
+    // Primary first, then the others in enumeration order; the index is the stream id.
+    static std::vector<MonitorInfo> monitors()
+    {
+        std::vector<MonitorInfo> found;
+        EnumDisplayMonitors(NULL, NULL, addMonitor, reinterpret_cast<LPARAM>(&found));
+        std::stable_partition(found.begin(), found.end(), [](const MonitorInfo& m) { return m.primary; });
+        if (found.size() > MAX_STREAMS) found.resize(MAX_STREAMS);
+        if (found.empty()) found.push_back(primary_monitor());
+        return found;
+    }
+
+    static cv::Mat capture_monitor(const MonitorInfo& monitor)
+    {
+        StageTimer timer(Stage::Capture);
+
+        int width = monitor.width;
+        int height = monitor.height;
 
         HDC hScreen = GetDC(NULL);
         HDC hDC = CreateCompatibleDC(hScreen);
         HBITMAP hBitmap = CreateCompatibleBitmap(hScreen, width, height);
         SelectObject(hDC, hBitmap);
 
-        BitBlt(hDC, 0, 0, width, height, hScreen, 0, 0, SRCCOPY);
+        BitBlt(hDC, 0, 0, width, height, hScreen, monitor.x, monitor.y, SRCCOPY);
 
         CURSORINFO ci = { sizeof(CURSORINFO) };
         if (GetCursorInfo(&ci) && (ci.flags & CURSOR_SHOWING)) {
             ICONINFO ii;
             if (GetIconInfo(ci.hCursor, &ii)) {
-                DrawIcon(hDC, ci.ptScreenPos.x - ii.xHotspot, ci.ptScreenPos.y - ii.yHotspot, ci.hCursor);
+                DrawIcon(hDC, ci.ptScreenPos.x - monitor.x - ii.xHotspot, ci.ptScreenPos.y - monitor.y - ii.yHotspot, ci.hCursor);
                 if (ii.hbmMask) DeleteObject(ii.hbmMask);
                 if (ii.hbmColor) DeleteObject(ii.hbmColor);
             }
@@ -45,9 +72,31 @@ public:
         DeleteDC(hDC);
         ReleaseDC(NULL, hScreen);
 
-        std::vector<uchar> jpg_buf;
-        cv::imencode(".jpg", img, jpg_buf, { cv::IMWRITE_JPEG_QUALITY, quality });
+        return img;
+    }
+
+private:
+    static MonitorInfo primary_monitor()
+    {
+        MonitorInfo monitor;
+        monitor.width = static_cast<uint16_t>(GetSystemMetrics(SM_CXSCREEN));
+        monitor.height = static_cast<uint16_t>(GetSystemMetrics(SM_CYSCREEN));
+        monitor.primary = true;
+        return monitor;
+    }
 
-        return std::vector<uint8_t>(jpg_buf.begin(), jpg_buf.end());
+    static BOOL CALLBACK addMonitor(HMONITOR handle, HDC, LPRECT, LPARAM data)
+    {
+        MONITORINFO info = { sizeof(MONITORINFO) };
+        if (GetMonitorInfoA(handle, &info)) {
+            MonitorInfo monitor;
+            monitor.x = info.rcMonitor.left;
+            monitor.y = info.rcMonitor.top;
+            monitor.width = static_cast<uint16_t>(info.rcMonitor.right - info.rcMonitor.left);
+            monitor.height = static_cast<uint16_t>(info.rcMonitor.bottom - info.rcMonitor.top);
+            monitor.primary = (info.dwFlags & MONITORINFOF_PRIMARY) != 0;
+            reinterpret_cast<std::vector<MonitorInfo>*>(data)->push_back(monitor);
+        }
+        return TRUE;
     }
 };
\ No newline at end of file
@@ -3,21 +3,53 @@
 #include <iostream>
 #include <vector>
 #include <optional>
+#include <chrono>
 #include <opencv2/opencv.hpp>
 #include "Network.hpp"
+#include "FrameCodec.hpp"
+
+constexpr sf::Keyboard::Key OVERLAY_KEY = sf::Keyboard::F12;
+constexpr float ZOOM_STEP = 1.25f;
+constexpr float MAX_ZOOM = 8.f;
 
 class ScreenViewer
 {
 public:
-    ScreenViewer();
+    explicit ScreenViewer(uint8_t streamId = 0);
 
 public:
     bool is_open() const;
     bool poll_events(Network* network_);
-    void display_frame(const std::optional<std::vector<uint8_t>>& frame);
+    bool display_frame(const ReceivedFrame& frame, Network* network_);
+    void update_overlay(const NetworkStats& stats);
+    bool attach_tile_store(const std::string& path);
+    std::vector<CacheEntry> cached_tiles() const;
+    uint64_t missing_tiles() const;
+    cv::Rect viewport() const;
+
+private:
+    void draw_overlay();
+    sf::Vector2i to_host(int x, int y, const Network* network_) const;
+    void zoom_at(int x, int y, float factor, Network* network_);
+    void pan(int dx, int dy, Network* network_);
+    void update_view();
 
 private:
+    uint8_t stream_;
     sf::RenderWindow window_;
     sf::Texture texture_;
     sf::Sprite sprite_;
+    sf::View view_;
+    float zoom_ = 1.f;
+    sf::Vector2f center_;
+    std::optional<sf::Vector2i> drag_;
+    FrameDecoder decoder_;
+
+    bool overlay_visible_ = false;
+    sf::Font font_;
+    sf::Text overlay_text_;
+    sf::RectangleShape overlay_bg_;
+    NetworkStats overlay_prev_;
+    std::chrono::steady_clock::time_point overlay_updated_;
+    std::chrono::microseconds decode_time_{ 0 };
 };
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+constexpr int SCROLL_MIN_LINES = 32;
+constexpr int SCROLL_CANDIDATES = 3;
+
+struct ScrollMatch
+{
+    cv::Rect source;
+    cv::Point target;
+};
+
+
+// ScrollDetector
+
+// Finds a block that moved vertically or horizontally between two frames. Rows (or
+// columns) of the changed area are hashed, unique hashes vote for a shift, and the
+// longest run of lines that still match under the winning shift becomes the copy.
+
+class ScrollDetector
+{
+public:
+    static std::optional<ScrollMatch> detect(const cv::Mat& previous, const cv::Mat& current);
+    static cv::Rect changed_area(const cv::Mat& previous, const cv::Mat& current);
+
+private:
+    static void hashRows(const cv::Mat& img, const cv::Rect& area, std::vector<uint64_t>& hashes);
+    static void hashColumns(const cv::Mat& img, const cv::Rect& area, std::vector<uint64_t>& hashes);
+    static bool bestShift(const std::vector<uint64_t>& previous, const std::vector<uint64_t>& current,
+        int& shift, int& start, int& length);
+};
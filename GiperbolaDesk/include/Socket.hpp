@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+#undef min
+#undef max
+
+using socklen_type = int;
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+
+using SOCKET = int;
+using socklen_type = socklen_t;
+
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+constexpr int SD_BOTH = SHUT_RDWR;
+constexpr int WSAEWOULDBLOCK = EWOULDBLOCK;
+
+inline int closesocket(SOCKET s) { return close(s); }
+inline int WSAGetLastError() { return errno; }
+inline int InetPtonA(int family, const char* src, void* dst) { return inet_pton(family, src, dst); }
+#endif
+
+inline bool socket_startup()
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    return true;
+#endif
+}
+
+inline void socket_cleanup()
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+inline bool make_address(const std::string& ip, unsigned int port, sockaddr_in& addr)
+{
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    return inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) == 1;
+}
+
+// Sends head and body as one datagram without joining them in a buffer first.
+inline int send_parts(SOCKET s, const uint8_t* head, size_t headSize, const uint8_t* body, size_t bodySize,
+    const sockaddr_in& to)
+{
+#ifdef _WIN32
+    WSABUF parts[2];
+    parts[0].buf = reinterpret_cast<CHAR*>(const_cast<uint8_t*>(head));
+    parts[0].len = static_cast<ULONG>(headSize);
+    parts[1].buf = reinterpret_cast<CHAR*>(const_cast<uint8_t*>(body));
+    parts[1].len = static_cast<ULONG>(bodySize);
+
+    DWORD sent = 0;
+    if (WSASendTo(s, parts, 2, &sent, 0, reinterpret_cast<const sockaddr*>(&to), sizeof(to), NULL, NULL) != 0) {
+        return SOCKET_ERROR;
+    }
+    return static_cast<int>(sent);
+#else
+    iovec parts[2];
+    parts[0].iov_base = const_cast<uint8_t*>(head);
+    parts[0].iov_len = headSize;
+    parts[1].iov_base = const_cast<uint8_t*>(body);
+    parts[1].iov_len = bodySize;
+
+    msghdr message{};
+    message.msg_name = const_cast<sockaddr_in*>(&to);
+    message.msg_namelen = sizeof(to);
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    ssize_t sent = sendmsg(s, &message, 0);
+    return sent < 0 ? SOCKET_ERROR : static_cast<int>(sent);
+#endif
+}
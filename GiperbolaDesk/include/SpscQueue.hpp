@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+
+// SpscQueue
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread.
+// Capacity must be a power of two; one slot stays empty to tell full from empty.
+// Head and tail sit on separate cache lines so the two threads do not share one.
+
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    // Producer side; false when the ring is full.
+    bool push(T value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1) & (Capacity - 1);
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots_[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false when the ring is empty.
+    bool pop(T& value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots_[head]);
+        head_.store((head + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: the next value without removing it, or nullptr.
+    const T* peek() const
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots_[head];
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    alignas(64) std::atomic<size_t> tail_{ 0 };
+    alignas(64) std::array<T, Capacity> slots_{};
+};
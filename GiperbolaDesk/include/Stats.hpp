@@ -0,0 +1,141 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class Stage : uint8_t
+{
+    Capture,
+    Encode,
+    Send,
+    Chunk,
+    GetFrame,
+    Decode,
+    Present,
+    OneWay,
+    CaptureToPresent,
+    Inject,
+    InputDelay,
+    ControlRtt,
+    Count
+};
+
+enum class Counter : uint8_t
+{
+    TileHits,
+    TileMisses,
+    TileBytesSaved,
+    TilesRefined,
+    BufferAllocations,
+    BufferReuses,
+    BytesCopied,
+    ArenaGrowths,
+    TasksStolen,
+    Count
+};
+
+const char* stage_name(Stage stage);
+const char* counter_name(Counter counter);
+
+
+// Histogram
+
+// Log-linear (HDR style) histogram of nanosecond durations: 64 linear
+// sub-buckets per power of two keep the relative error under 1.6%.
+// Only the owning thread writes, so recording is a plain relaxed store.
+
+class Histogram
+{
+public:
+    static constexpr int SUB_BITS = 7;
+    static constexpr int HALF = 1 << (SUB_BITS - 1);
+    static constexpr int MAX_BITS = 36;
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 2) * HALF;
+
+public:
+    void record(uint64_t value);
+    void merge_into(std::vector<uint64_t>& out) const;
+    void merge_into(Histogram& out) const;
+    void clear();
+
+    static size_t index_of(uint64_t value);
+    static uint64_t value_at(size_t index);
+    static uint64_t percentile(const std::vector<uint64_t>& counts, double p);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts_{};
+};
+
+
+// Stats
+
+// Every thread records into histograms of its own. When a thread ends, its counts move to
+// retired_ and its histograms go to the next new thread, so the registry only grows to
+// the most threads ever alive at once.
+
+class Stats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static void record(Stage stage, Clock::duration elapsed);
+    static void add(Counter counter, uint64_t value = 1);
+    static uint64_t counter(Counter counter);
+    static std::string report();
+    static bool dump(const std::string& path);
+    static void reset();
+    static void start_reporter(const std::string& path, std::chrono::milliseconds interval,
+        const std::string& session = "");
+    static void stop_reporter();
+
+private:
+    struct ThreadStats
+    {
+        std::array<Histogram, static_cast<size_t>(Stage::Count)> stages;
+    };
+
+    static ThreadStats& local();
+    static ThreadStats* acquireThread();
+    static void retireThread(ThreadStats* stats);
+    static void reporterLoop(const std::string& path, std::chrono::milliseconds interval);
+
+private:
+    static std::mutex registry_mutex_;
+    static std::vector<std::unique_ptr<ThreadStats>> registry_;
+    static std::vector<ThreadStats*> free_;
+    static ThreadStats retired_;
+    static std::mutex reporter_mutex_;
+    static std::condition_variable reporter_cv_;
+    static bool reporting_;
+    static std::thread reporter_;
+    static std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::Count)> counters_;
+};
+
+
+// StageTimer
+
+class StageTimer
+{
+public:
+    explicit StageTimer(Stage stage)
+        : stage_(stage), start_(Stats::Clock::now()) { }
+
+    ~StageTimer()
+    {
+        Stats::record(stage_, Stats::Clock::now() - start_);
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage stage_;
+    Stats::Clock::time_point start_;
+};
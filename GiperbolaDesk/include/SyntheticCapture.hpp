@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <opencv2/opencv.hpp>
+
+constexpr int SYNTHETIC_SCROLL_STEP = 24;
+constexpr int SYNTHETIC_SWITCH_FRAMES = 15;
+
+enum class SyntheticContent : uint8_t
+{
+    Text,
+    Gradient,
+    Photo,
+    Video,
+    Scroll,
+    Switch,
+    Player,
+    Count
+};
+
+const char* content_name(SyntheticContent content);
+
+
+// SyntheticCapture
+
+// Deterministic stand-in for the screen grabber: renders desktop-like BGR frames
+// without a display so the pipeline can be exercised on headless machines.
+
+class SyntheticCapture
+{
+public:
+    SyntheticCapture(SyntheticContent content, int width, int height, uint32_t seed = 1);
+
+public:
+    cv::Mat next_frame();
+    SyntheticContent content() const;
+    int width() const;
+    int height() const;
+
+private:
+    void renderText(cv::Mat& target, int height);
+    void renderGradient();
+    void renderPhoto(cv::Mat& target, int width, int height);
+    void renderVideo(const cv::Mat& source, cv::Mat target) const;
+    cv::Rect playerArea() const;
+    void drawChrome(cv::Mat& frame) const;
+    void drawCursor(cv::Mat& frame) const;
+
+private:
+    SyntheticContent content_;
+    int width_, height_;
+    uint64_t frame_ = 0;
+    cv::Mat base_;
+    cv::Mat other_;
+    std::mt19937 rng_;
+};
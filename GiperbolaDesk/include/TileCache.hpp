@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "Protocol.hpp"
+
+constexpr int TILE_SIZE = 64;
+constexpr size_t TILE_CACHE_CAPACITY = 4096;
+
+TileHash tile_hash(const cv::Mat& tile);
+
+struct TileHashHasher
+{
+    size_t operator()(const TileHash& hash) const { return static_cast<size_t>(hash.lo ^ (hash.hi >> 1)); }
+};
+
+
+// TileCache
+
+// LRU of tiles keyed by content hash. The sender keeps one with the cost of each tile
+// and the viewer one with where its pixels live; both see the same inserts and lookups
+// in the same order, so the sender knows which tiles the viewer holds. keys() lists
+// the tiles oldest first, so inserting them in that order rebuilds the same LRU.
+
+template <typename Value>
+class TileCache
+{
+public:
+    explicit TileCache(size_t capacity = TILE_CACHE_CAPACITY)
+        : capacity_(capacity) { }
+
+    bool contains(const TileHash& hash) const
+    {
+        return index_.count(hash) != 0;
+    }
+
+    const Value* peek(const TileHash& hash) const
+    {
+        auto it = index_.find(hash);
+        return it == index_.end() ? nullptr : &it->second->second;
+    }
+
+    // Like peek(), the entry keeps its place in the LRU.
+    Value* peek(const TileHash& hash)
+    {
+        auto it = index_.find(hash);
+        return it == index_.end() ? nullptr : &it->second->second;
+    }
+
+    Value* find(const TileHash& hash)
+    {
+        auto it = index_.find(hash);
+        if (it == index_.end()) return nullptr;
+
+        order_.splice(order_.begin(), order_, it->second);
+        return &it->second->second;
+    }
+
+    // Returns the value that was evicted to make room, if any.
+    std::optional<Value> insert(const TileHash& hash, Value value)
+    {
+        auto it = index_.find(hash);
+        if (it != index_.end()) {
+            it->second->second = std::move(value);
+            order_.splice(order_.begin(), order_, it->second);
+            return std::nullopt;
+        }
+
+        std::optional<Value> evicted;
+        if (index_.size() >= capacity_) {
+            evicted = std::move(order_.back().second);
+            index_.erase(order_.back().first);
+            order_.pop_back();
+        }
+        order_.emplace_front(hash, std::move(value));
+        index_.emplace(hash, order_.begin());
+        return evicted;
+    }
+
+    std::vector<TileHash> keys() const
+    {
+        std::vector<TileHash> out;
+        out.reserve(index_.size());
+        for (auto it = order_.rbegin(); it != order_.rend(); ++it) {
+            out.push_back(it->first);
+        }
+        return out;
+    }
+
+    size_t size() const { return index_.size(); }
+    size_t capacity() const { return capacity_; }
+
+    void clear()
+    {
+        index_.clear();
+        order_.clear();
+    }
+
+private:
+    using Entry = std::pair<TileHash, Value>;
+
+    size_t capacity_;
+    std::list<Entry> order_;
+    std::unordered_map<TileHash, typename std::list<Entry>::iterator, TileHashHasher> index_;
+};
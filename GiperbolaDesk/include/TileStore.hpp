@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Protocol.hpp"
+#include "TileCache.hpp"
+
+constexpr uint32_t TILE_STORE_MAGIC = 0x54494C45;
+constexpr uint32_t TILE_STORE_VERSION = 2;
+constexpr size_t TILE_BYTES = TILE_SIZE * TILE_SIZE * 4;
+constexpr const char* TILE_STORE_DIR = "tile_cache";
+
+std::string tile_store_path(const std::string& host, unsigned int port, uint8_t streamId = 0);
+
+
+// TileStore
+
+// Fixed slots for the viewer's cached tiles: a header, one index entry per slot and
+// TILE_BYTES of RGBA per slot. Backed by a memory-mapped file when opened, so the cache
+// outlives the session; otherwise by plain memory. Entries with stamp 0 are free and
+// the stamp orders the rest from least to most recently used.
+
+class TileStore
+{
+public:
+    struct Entry
+    {
+        TileHash hash;
+        uint16_t width;
+        uint16_t height;
+        uint8_t exact;
+        uint32_t cost;
+        uint64_t stamp;
+    };
+
+public:
+    explicit TileStore(size_t capacity = TILE_CACHE_CAPACITY);
+    ~TileStore();
+
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+public:
+    bool open(const std::string& path);
+    void close();
+    bool persistent() const;
+    size_t capacity() const;
+
+    Entry& entry(uint32_t slot);
+    uint8_t* pixels(uint32_t slot);
+    uint64_t next_stamp();
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t tileBytes;
+        uint64_t stamp;
+    };
+
+    size_t fileSize() const;
+    uint8_t* base();
+    Header& header();
+    void format();
+
+private:
+    size_t capacity_;
+    uint8_t* base_ = nullptr;
+    std::vector<uint8_t> memory_;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
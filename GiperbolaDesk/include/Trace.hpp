@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Protocol.hpp"
+
+constexpr size_t TRACE_CAPACITY = 1 << 16;
+constexpr size_t TRACE_SEND_BATCH = 32;
+
+
+// Trace
+
+// Opt-in per-frame span recorder. Events go into a fixed ring buffer, so a long
+// session keeps only the most recent TRACE_CAPACITY events; flush() writes them
+// as Chrome trace-event JSON that loads in Perfetto or chrome://tracing.
+
+class Trace
+{
+public:
+    static void enable(size_t capacity = TRACE_CAPACITY);
+    static void disable();
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void name_thread(const std::string& name);
+    static void complete(const char* name, uint32_t frameId, uint64_t startUs, uint64_t endUs);
+    static void instant(const char* name, uint32_t frameId, uint64_t timeUs);
+    static bool flush(const std::string& path);
+
+private:
+    struct Event
+    {
+        const char* name;
+        uint32_t frameId;
+        uint32_t thread;
+        uint64_t start;
+        uint64_t duration;
+        char phase;
+    };
+
+    static uint32_t threadId();
+    static void push(const Event& event);
+
+private:
+    static std::atomic<bool> enabled_;
+    static std::atomic<uint64_t> head_;
+    static std::vector<Event> ring_;
+    static std::mutex names_mutex_;
+    static std::map<uint32_t, std::string> thread_names_;
+};
+
+
+// TraceSpan
+
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name, uint32_t frameId)
+        : name_(name), frameId_(frameId), start_(Trace::enabled() ? monotonic_us() : 0) { }
+
+    ~TraceSpan()
+    {
+        if (start_ != 0) {
+            Trace::complete(name_, frameId_, start_, monotonic_us());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    uint32_t frameId_;
+    uint64_t start_;
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <vector>
+#include "Arena.hpp"
+#include "BufferPool.hpp"
+#include "Protocol.hpp"
+#include "Trace.hpp"
+
+constexpr size_t CHUNK_DATA_SIZE = 1400;
+constexpr uint32_t FRAME_RESTART_GAP = 1000;
+constexpr size_t MAX_PENDING_FRAMES = 4;
+
+struct FrameAssembly
+{
+    FrameBuffer data;
+    uint8_t* received = nullptr;
+    size_t receivedChunks = 0;
+    size_t totalChunks = 0;
+    size_t size = 0;
+    uint64_t captureTime = 0;
+    uint64_t firstChunkTime = 0;
+};
+
+struct ReceivedFrame
+{
+    FrameBuffer data;
+    uint8_t streamId = 0;
+    uint32_t frameId = 0;
+    uint64_t captureTime = 0;
+    // Receive session the frame came from, see Network::session_active().
+    uint32_t session = 0;
+};
+
+
+// Packetizer
+
+class Packetizer
+{
+public:
+    // send(header, headerSize, payload, payloadSize) gets every chunk as two parts: the
+    // payload points into frame, so the bytes are not copied into a packet first.
+    template <typename SendFn>
+    static bool packetize(const uint8_t* frame, size_t size, uint32_t frameId, uint64_t captureTime,
+        uint8_t streamId, uint32_t sessionId, uint32_t& sequence, SendFn&& send)
+    {
+        size_t totalChunks = (size + CHUNK_DATA_SIZE - 1) / CHUNK_DATA_SIZE;
+        uint8_t packet[ChunkHeader::SIZE];
+
+        for (size_t i = 0; i < totalChunks; i++) {
+            ChunkHeader header;
+            header.streamId = streamId;
+            header.sessionId = sessionId;
+            header.frameId = frameId;
+            header.chunkIndex = static_cast<uint16_t>(i);
+            header.totalChunks = static_cast<uint16_t>(totalChunks);
+            header.sequence = sequence++;
+            header.captureTime = captureTime;
+
+            size_t offset = i * CHUNK_DATA_SIZE;
+            size_t chunkSize = std::min(size - offset, CHUNK_DATA_SIZE);
+
+            header.write(packet);
+            if (!send(packet, ChunkHeader::SIZE, frame + offset, chunkSize)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+// FrameAssembler
+
+// Per-frame bookkeeping (map nodes, received flags) lives in an Arena that is reset
+// whenever no frame is pending, which with in-order delivery is after every frame.
+// At most MAX_PENDING_FRAMES frames are held at once; a new one pushes out the oldest.
+
+class FrameAssembler
+{
+public:
+    FrameAssembler() = default;
+    FrameAssembler(const FrameAssembler&) = delete;
+    FrameAssembler& operator=(const FrameAssembler&) = delete;
+
+public:
+    std::optional<ReceivedFrame> add_chunk(const ChunkHeader& header, const uint8_t* data, size_t dataSize);
+    uint64_t dropped_frames() const;
+    size_t pending_frames() const;
+    void reset();
+
+private:
+    using FrameMap = std::map<uint32_t, FrameAssembly, std::less<uint32_t>,
+        ArenaAllocator<std::pair<const uint32_t, FrameAssembly>>>;
+
+    void recycleArena();
+
+private:
+    Arena arena_;
+    FrameMap frames_{ FrameMap::allocator_type(&arena_) };
+    uint32_t lastCompleted_ = 0;
+    uint64_t dropped_ = 0;
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// WorkerPool
+
+// Fixed set of threads, one per core by default, each with its own task deque. A task
+// submitted from inside a task goes to the deque of the worker running it, and a worker
+// runs its deque in order, so jobs that resubmit themselves take turns on a core rather
+// than the newest one starving the rest. An idle worker steals from the back of another
+// worker's deque before going to sleep. submit_at() parks a task until a point in time
+// instead of keeping a thread blocked in a sleep. Steals show up in Stats as tasks_stolen.
+
+class WorkerPool
+{
+public:
+    using Task = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+
+    explicit WorkerPool(size_t workers = 0);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+public:
+    void submit(Task task);
+    void submit_at(Clock::time_point due, Task task);
+    size_t size() const;
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    static constexpr Clock::rep NO_DEADLINE = std::numeric_limits<Clock::rep>::max();
+
+    struct Timed
+    {
+        Clock::time_point due;
+        Task task;
+    };
+
+    void run(size_t index);
+    void push(size_t index, Task task);
+    bool popLocal(size_t index, Task& task);
+    bool steal(size_t index, Task& task);
+    size_t releaseDue(size_t index);
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<Timed> timed_;
+    // Due time of timed_.front() in Clock ticks, so workers can check it without the lock.
+    std::atomic<Clock::rep> nextDue_{ NO_DEADLINE };
+    std::atomic<size_t> pending_{ 0 };
+    std::atomic<size_t> next_{ 0 };
+    bool running_ = true;
+};
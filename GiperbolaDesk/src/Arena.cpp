@@ -0,0 +1,77 @@
+#include "../include/Arena.hpp"
+#include <algorithm>
+#include <new>
+#include "../include/Stats.hpp"
+
+
+// Arena
+
+Arena::Arena(size_t blockSize)
+    : blockSize_(blockSize) { }
+
+Arena::~Arena()
+{
+    for (auto& block : blocks_) {
+        ::operator delete(block.bytes);
+    }
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    while (true) {
+        if (current_ < blocks_.size()) {
+            Block& block = blocks_[current_];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.bytes);
+            size_t start = ((base + offset_ + alignment - 1) & ~(alignment - 1)) - base;
+            if (start + size <= block.size) {
+                offset_ = start + size;
+                used_ += size;
+                return block.bytes + start;
+            }
+            if (current_ + 1 < blocks_.size()) {
+                current_++;
+                offset_ = 0;
+                continue;
+            }
+        }
+        grow(size + alignment);
+        current_ = blocks_.size() - 1;
+        offset_ = 0;
+    }
+}
+
+void Arena::reset()
+{
+    if (blocks_.size() > 1) {
+        size_t total = capacity();
+        for (auto& block : blocks_) {
+            ::operator delete(block.bytes);
+        }
+        blocks_.clear();
+        grow(total);
+    }
+    current_ = 0;
+    offset_ = 0;
+    used_ = 0;
+}
+
+size_t Arena::used() const
+{
+    return used_;
+}
+
+size_t Arena::capacity() const
+{
+    size_t total = 0;
+    for (auto& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+void Arena::grow(size_t size)
+{
+    size = std::max(size, blockSize_);
+    blocks_.push_back(Block{ static_cast<uint8_t*>(::operator new(size)), size });
+    Stats::add(Counter::ArenaGrowths);
+}
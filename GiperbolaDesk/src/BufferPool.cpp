@@ -0,0 +1,173 @@
+#include "../include/BufferPool.hpp"
+#include <cstring>
+#include <new>
+#include <utility>
+#include "../include/Stats.hpp"
+
+
+// FrameBuffer
+
+FrameBuffer::FrameBuffer(Block* block, size_t size)
+    : block_(block), size_(size) { }
+
+FrameBuffer::FrameBuffer(const FrameBuffer& other)
+    : block_(other.block_), size_(other.size_)
+{
+    if (block_) block_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameBuffer::FrameBuffer(FrameBuffer&& other) noexcept
+    : block_(std::exchange(other.block_, nullptr)), size_(std::exchange(other.size_, 0)) { }
+
+FrameBuffer& FrameBuffer::operator=(const FrameBuffer& other)
+{
+    if (this != &other) {
+        if (other.block_) other.block_->refs.fetch_add(1, std::memory_order_relaxed);
+        release();
+        block_ = other.block_;
+        size_ = other.size_;
+    }
+    return *this;
+}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        block_ = std::exchange(other.block_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+FrameBuffer::~FrameBuffer()
+{
+    release();
+}
+
+uint8_t* FrameBuffer::data()
+{
+    return block_ ? block_->bytes : nullptr;
+}
+
+const uint8_t* FrameBuffer::data() const
+{
+    return block_ ? block_->bytes : nullptr;
+}
+
+size_t FrameBuffer::size() const
+{
+    return size_;
+}
+
+size_t FrameBuffer::capacity() const
+{
+    return block_ ? block_->capacity : 0;
+}
+
+bool FrameBuffer::empty() const
+{
+    return size_ == 0;
+}
+
+void FrameBuffer::resize(size_t size)
+{
+    if (size > capacity()) {
+        FrameBuffer bigger = BufferPool::acquire(size);
+        if (size_ > 0) {
+            std::memcpy(bigger.data(), data(), size_);
+            BufferPool::count_copy(size_);
+        }
+        *this = std::move(bigger);
+    }
+    size_ = size;
+}
+
+long FrameBuffer::use_count() const
+{
+    return block_ ? block_->refs.load(std::memory_order_relaxed) : 0;
+}
+
+void FrameBuffer::release()
+{
+    if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        BufferPool::recycle(block_);
+    }
+    block_ = nullptr;
+    size_ = 0;
+}
+
+
+// BufferPool
+
+std::mutex BufferPool::mutex_;
+std::array<std::vector<FrameBuffer::Block*>, BUFFER_SIZE_CLASSES> BufferPool::free_;
+
+FrameBuffer BufferPool::acquire(size_t size)
+{
+    const size_t index = sizeClass(size);
+    if (index < BUFFER_SIZE_CLASSES) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& blocks = free_[index];
+        if (!blocks.empty()) {
+            FrameBuffer::Block* block = blocks.back();
+            blocks.pop_back();
+            block->refs.store(1, std::memory_order_relaxed);
+            Stats::add(Counter::BufferReuses);
+            return FrameBuffer(block, size);
+        }
+    }
+
+    auto* block = new FrameBuffer::Block;
+    block->sizeClass = index;
+    block->capacity = index < BUFFER_SIZE_CLASSES ? classBytes(index) : size;
+    block->bytes = static_cast<uint8_t*>(::operator new(block->capacity, std::align_val_t(BUFFER_ALIGNMENT)));
+    Stats::add(Counter::BufferAllocations);
+    return FrameBuffer(block, size);
+}
+
+void BufferPool::count_copy(size_t bytes)
+{
+    Stats::add(Counter::BytesCopied, bytes);
+}
+
+void BufferPool::trim()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& blocks : free_) {
+        for (auto* block : blocks) {
+            ::operator delete(block->bytes, std::align_val_t(BUFFER_ALIGNMENT));
+            delete block;
+        }
+        blocks.clear();
+    }
+}
+
+size_t BufferPool::sizeClass(size_t size)
+{
+    size_t index = 0;
+    while (index < BUFFER_SIZE_CLASSES && classBytes(index) < size) {
+        index++;
+    }
+    return index;
+}
+
+size_t BufferPool::classBytes(size_t sizeClass)
+{
+    return BUFFER_MIN_SIZE << sizeClass;
+}
+
+void BufferPool::recycle(FrameBuffer::Block* block)
+{
+    if (block->sizeClass < BUFFER_SIZE_CLASSES) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& blocks = free_[block->sizeClass];
+        if (blocks.size() < BUFFER_KEEP_PER_CLASS) {
+            blocks.push_back(block);
+            return;
+        }
+    }
+
+    ::operator delete(block->bytes, std::align_val_t(BUFFER_ALIGNMENT));
+    delete block;
+}
@@ -0,0 +1,418 @@
+#include "../include/Codec.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+
+
+const char* codec_name(PixelCodec codec)
+{
+    switch (codec) {
+    case PixelCodec::Jpeg:    return "jpeg";
+    case PixelCodec::Palette: return "palette";
+    case PixelCodec::Qoi:     return "qoi";
+    default:                  return "unknown";
+    }
+}
+
+bool Codec::encode(PixelCodec codec, const cv::Mat& img, std::vector<uint8_t>& out, int quality)
+{
+    switch (codec) {
+    case PixelCodec::Jpeg:
+        out = encode_jpg(img, quality);
+        return !out.empty();
+    case PixelCodec::Palette:
+        return encode_palette(img, out);
+    case PixelCodec::Qoi:
+        encode_qoi(img, out);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Codec::decode(PixelCodec codec, const uint8_t* data, size_t size, int width, int height, std::vector<uint8_t>& rgba)
+{
+    switch (codec) {
+    case PixelCodec::Jpeg: {
+        int w = 0, h = 0;
+        return decode_rgba(data, size, rgba, w, h) && w == width && h == height;
+    }
+    case PixelCodec::Palette:
+        return decode_palette(data, size, width, height, rgba);
+    case PixelCodec::Qoi:
+        return decode_qoi(data, size, width, height, rgba);
+    default:
+        return false;
+    }
+}
+
+std::vector<uint8_t> Codec::encode_jpg(const cv::Mat& img, int quality)
+{
+    std::vector<uchar> jpg_buf;
+    cv::imencode(".jpg", img, jpg_buf, { cv::IMWRITE_JPEG_QUALITY, quality });
+
+    return std::vector<uint8_t>(jpg_buf.begin(), jpg_buf.end());
+}
+
+cv::Mat Codec::decode_jpg(const uint8_t* data, size_t size)
+{
+    cv::Mat encoded(1, static_cast<int>(size), CV_8UC1, const_cast<uint8_t*>(data));
+    return cv::imdecode(encoded, cv::IMREAD_COLOR);
+}
+
+bool Codec::decode_rgba(const uint8_t* data, size_t size, std::vector<uint8_t>& rgba, int& width, int& height)
+{
+    cv::Mat bgr = decode_jpg(data, size);
+    if (bgr.empty()) return false;
+
+    width = bgr.cols;
+    height = bgr.rows;
+    rgba.resize(static_cast<size_t>(width) * height * 4);
+
+    cv::Mat out(height, width, CV_8UC4, rgba.data());
+    cv::cvtColor(bgr, out, cv::COLOR_BGR2RGBA);
+    return true;
+}
+
+
+// Palette
+
+// Lossless coding for synthetic content: up to PALETTE_MAX_COLORS colours, then the
+// pixel indices in raster order as PackBits packets. A control byte below 128 is
+// followed by that many plus one literal indices; 128 and above repeats the next
+// index (control - 126) times.
+// colorCount - 1 u8 | (r, g, b) x colorCount | packets
+
+namespace
+{
+    class PaletteTable
+    {
+    public:
+        PaletteTable() { slots_.fill(EMPTY); }
+
+        // Returns the colour's index, or -1 once the palette is full.
+        int index_of(uint32_t color)
+        {
+            size_t slot = (color * 0x9E3779B1u) >> (32 - TABLE_BITS);
+            while (slots_[slot] != EMPTY) {
+                if (colors_[slots_[slot]] == color) return slots_[slot];
+                slot = (slot + 1) & (TABLE_SIZE - 1);
+            }
+            if (count_ == PALETTE_MAX_COLORS) return -1;
+
+            colors_[count_] = color;
+            slots_[slot] = static_cast<uint16_t>(count_);
+            return count_++;
+        }
+
+        int size() const { return count_; }
+        uint32_t color(int index) const { return colors_[index]; }
+
+    private:
+        static constexpr int TABLE_BITS = 10;
+        static constexpr size_t TABLE_SIZE = size_t(1) << TABLE_BITS;
+        static constexpr uint16_t EMPTY = 0xFFFF;
+
+        std::array<uint16_t, TABLE_SIZE> slots_;
+        std::array<uint32_t, PALETTE_MAX_COLORS> colors_{};
+        int count_ = 0;
+    };
+
+    uint32_t pixel_at(const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[0];
+    }
+
+    int contrast(const uint8_t* a, const uint8_t* b)
+    {
+        return std::abs(a[0] - b[0]) + std::abs(a[1] - b[1]) + std::abs(a[2] - b[2]);
+    }
+}
+
+// Text, UI and flat fills have few colours, few horizontal colour changes and mostly
+// sharp ones. Smooth gradients can have few colours too, but their changes are small
+// steps that JPEG codes far more cheaply than a palette.
+ImageClass Codec::classify(const cv::Mat& img)
+{
+    PaletteTable palette;
+    size_t edges = 0, sharp = 0;
+
+    for (int y = 0; y < img.rows; y++) {
+        const uint8_t* p = img.ptr<uint8_t>(y);
+        uint32_t last = pixel_at(p);
+        if (palette.index_of(last) < 0) return ImageClass::Natural;
+
+        for (int x = 1; x < img.cols; x++) {
+            uint32_t color = pixel_at(p + x * 3);
+            if (color == last) continue;
+
+            edges++;
+            if (contrast(p + x * 3, p + (x - 1) * 3) >= SHARP_EDGE_CONTRAST) sharp++;
+            last = color;
+            if (palette.index_of(color) < 0) return ImageClass::Natural;
+        }
+    }
+
+    if (edges > PALETTE_MAX_EDGES * img.total()) return ImageClass::Natural;
+    if (palette.size() > PALETTE_FEW_COLORS && sharp * 2 < edges) return ImageClass::Natural;
+    return ImageClass::Synthetic;
+}
+
+bool Codec::encode_palette(const cv::Mat& img, std::vector<uint8_t>& out)
+{
+    PaletteTable palette;
+    std::vector<uint8_t> indices(img.total());
+    uint8_t* index = indices.data();
+
+    for (int y = 0; y < img.rows; y++) {
+        const uint8_t* p = img.ptr<uint8_t>(y);
+        uint32_t last = ~0u;
+        int current = 0;
+        for (int x = 0; x < img.cols; x++) {
+            uint32_t color = pixel_at(p + x * 3);
+            if (color != last) {
+                current = palette.index_of(color);
+                if (current < 0) return false;
+                last = color;
+            }
+            *index++ = static_cast<uint8_t>(current);
+        }
+    }
+
+    out.clear();
+    out.reserve(1 + palette.size() * 3 + indices.size() / 4);
+    out.push_back(static_cast<uint8_t>(palette.size() - 1));
+    for (int i = 0; i < palette.size(); i++) {
+        uint32_t color = palette.color(i);
+        out.push_back(static_cast<uint8_t>(color >> 16));
+        out.push_back(static_cast<uint8_t>(color >> 8));
+        out.push_back(static_cast<uint8_t>(color));
+    }
+
+    const size_t count = indices.size();
+    size_t i = 0, literal = 0;
+    auto flushLiteral = [&](size_t end) {
+        while (literal < end) {
+            size_t n = std::min<size_t>(128, end - literal);
+            out.push_back(static_cast<uint8_t>(n - 1));
+            out.insert(out.end(), indices.begin() + literal, indices.begin() + literal + n);
+            literal += n;
+        }
+    };
+
+    while (i < count) {
+        size_t run = 1;
+        while (i + run < count && run < 129 && indices[i + run] == indices[i]) run++;
+
+        if (run >= 2) {
+            flushLiteral(i);
+            out.push_back(static_cast<uint8_t>(run + 126));
+            out.push_back(indices[i]);
+            i += run;
+            literal = i;
+        }
+        else {
+            i++;
+        }
+    }
+    flushLiteral(count);
+    return true;
+}
+
+bool Codec::decode_palette(const uint8_t* data, size_t size, int width, int height, std::vector<uint8_t>& rgba)
+{
+    if (size < 1) return false;
+
+    const size_t colors = static_cast<size_t>(data[0]) + 1;
+    if (size < 1 + colors * 3) return false;
+
+    std::array<std::array<uint8_t, 4>, PALETTE_MAX_COLORS> palette{};
+    for (size_t i = 0; i < colors; i++) {
+        const uint8_t* c = data + 1 + i * 3;
+        palette[i] = { c[0], c[1], c[2], 255 };
+    }
+
+    const size_t count = static_cast<size_t>(width) * height;
+    rgba.resize(count * 4);
+    uint8_t* out = rgba.data();
+    const uint8_t* p = data + 1 + colors * 3;
+    const uint8_t* end = data + size;
+    size_t written = 0;
+
+    auto put = [&](uint8_t index, size_t n) {
+        if (index >= colors || written + n > count) return false;
+        for (size_t k = 0; k < n; k++) {
+            std::memcpy(out + (written + k) * 4, palette[index].data(), 4);
+        }
+        written += n;
+        return true;
+    };
+
+    while (written < count) {
+        if (p >= end) return false;
+        uint8_t control = *p++;
+        if (control < 128) {
+            size_t n = static_cast<size_t>(control) + 1;
+            if (static_cast<size_t>(end - p) < n) return false;
+            for (size_t k = 0; k < n; k++) {
+                if (!put(p[k], 1)) return false;
+            }
+            p += n;
+        }
+        else {
+            if (p >= end || !put(*p++, static_cast<size_t>(control) - 126)) return false;
+        }
+    }
+    return p == end;
+}
+
+
+// Qoi
+
+// The QOI opcodes (https://qoiformat.org) without header, alpha or end marker: every
+// pixel is a run of the previous one, a slot in a 64-entry table of recent colours, a
+// small difference to the previous pixel or a literal RGB. The previous pixel carries
+// over from the end of one row to the start of the next.
+
+namespace
+{
+    constexpr uint8_t QOI_OP_INDEX = 0x00;
+    constexpr uint8_t QOI_OP_DIFF = 0x40;
+    constexpr uint8_t QOI_OP_LUMA = 0x80;
+    constexpr uint8_t QOI_OP_RUN = 0xC0;
+    constexpr uint8_t QOI_OP_RGB = 0xFE;
+    constexpr uint8_t QOI_MASK = 0xC0;
+    constexpr int QOI_MAX_RUN = 62;
+
+    int qoi_hash(uint8_t r, uint8_t g, uint8_t b)
+    {
+        return (r * 3 + g * 5 + b * 7 + 255 * 11) & 63;
+    }
+}
+
+void Codec::encode_qoi(const cv::Mat& img, std::vector<uint8_t>& out)
+{
+    // Worst case is a literal for every pixel.
+    out.resize(img.total() * 4);
+    uint8_t* o = out.data();
+
+    std::array<uint32_t, 64> seen{};
+    uint32_t previous = 0;
+    uint8_t pr = 0, pg = 0, pb = 0;
+    int run = 0;
+
+    for (int y = 0; y < img.rows; y++) {
+        const uint8_t* p = img.ptr<uint8_t>(y);
+        const uint8_t* end = p + static_cast<size_t>(img.cols) * 3;
+
+        for (; p < end; p += 3) {
+            const uint8_t b = p[0], g = p[1], r = p[2];
+            const uint32_t color = (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | b;
+            if (color == previous) {
+                if (++run == QOI_MAX_RUN) {
+                    *o++ = static_cast<uint8_t>(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                *o++ = static_cast<uint8_t>(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            const int slot = qoi_hash(r, g, b);
+            if (seen[slot] == color) {
+                *o++ = static_cast<uint8_t>(QOI_OP_INDEX | slot);
+            }
+            else {
+                seen[slot] = color;
+                const int dr = static_cast<int8_t>(r - pr);
+                const int dg = static_cast<int8_t>(g - pg);
+                const int db = static_cast<int8_t>(b - pb);
+                const int drg = dr - dg, dbg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *o++ = static_cast<uint8_t>(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                }
+                else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    *o++ = static_cast<uint8_t>(QOI_OP_LUMA | (dg + 32));
+                    *o++ = static_cast<uint8_t>((drg + 8) << 4 | (dbg + 8));
+                }
+                else {
+                    *o++ = QOI_OP_RGB;
+                    *o++ = r;
+                    *o++ = g;
+                    *o++ = b;
+                }
+            }
+            previous = color;
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+
+    if (run > 0) {
+        *o++ = static_cast<uint8_t>(QOI_OP_RUN | (run - 1));
+    }
+    out.resize(static_cast<size_t>(o - out.data()));
+}
+
+bool Codec::decode_qoi(const uint8_t* data, size_t size, int width, int height, std::vector<uint8_t>& rgba)
+{
+    const size_t count = static_cast<size_t>(width) * height;
+    rgba.resize(count * 4);
+    uint8_t* o = rgba.data();
+    uint8_t* const end = o + count * 4;
+
+    std::array<uint8_t, 4> px = { 0, 0, 0, 255 };
+    std::array<std::array<uint8_t, 4>, 64> seen;
+    seen.fill(px);
+    const uint8_t* p = data;
+    const uint8_t* const last = data + size;
+
+    while (o < end) {
+        if (p >= last) return false;
+
+        const uint8_t op = *p++;
+        if (op == QOI_OP_RGB) {
+            if (last - p < 3) return false;
+            px = { p[0], p[1], p[2], 255 };
+            p += 3;
+        }
+        else if ((op & QOI_MASK) == QOI_OP_RUN) {
+            const size_t run = static_cast<size_t>(op & 0x3F) + 1;
+            if (static_cast<size_t>(end - o) < run * 4) return false;
+            for (size_t i = 0; i < run; i++, o += 4) {
+                std::memcpy(o, px.data(), 4);
+            }
+            continue;
+        }
+        else if ((op & QOI_MASK) == QOI_OP_INDEX) {
+            px = seen[op];
+            std::memcpy(o, px.data(), 4);
+            o += 4;
+            continue;
+        }
+        else if ((op & QOI_MASK) == QOI_OP_DIFF) {
+            px[0] = static_cast<uint8_t>(px[0] + ((op >> 4) & 3) - 2);
+            px[1] = static_cast<uint8_t>(px[1] + ((op >> 2) & 3) - 2);
+            px[2] = static_cast<uint8_t>(px[2] + (op & 3) - 2);
+        }
+        else {
+            if (p >= last) return false;
+            const int dg = (op & 0x3F) - 32;
+            const uint8_t next = *p++;
+            px[0] = static_cast<uint8_t>(px[0] + dg - 8 + (next >> 4));
+            px[1] = static_cast<uint8_t>(px[1] + dg);
+            px[2] = static_cast<uint8_t>(px[2] + dg - 8 + (next & 0x0F));
+        }
+
+        seen[qoi_hash(px[0], px[1], px[2])] = px;
+        std::memcpy(o, px.data(), 4);
+        o += 4;
+    }
+    return p == last;
+}
@@ -0,0 +1,130 @@
+#include "../include/CpuGovernor.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+
+double parse_cpu_budget(const char* value)
+{
+    if (!value || !*value) {
+        return 0.0;
+    }
+
+    char* end = nullptr;
+    double budget = std::strtod(value, &end);
+    if (end == value || budget <= 0.0) {
+        return 0.0;
+    }
+    if (std::strcmp(end, "%") == 0) {
+        return budget / 100.0;
+    }
+    return *end == '\0' ? budget : 0.0;
+}
+
+
+// CpuGovernor
+
+// Credit is kept in microseconds of CPU time; the budget refills budget_ of them per
+// microsecond of wall time, up to GOVERNOR_BURST worth.
+
+CpuGovernor::CpuGovernor(double budget)
+    : budget_(budget), refilled_(Clock::now()), windowStart_(refilled_) { }
+
+bool CpuGovernor::enabled() const
+{
+    return budget_ > 0.0;
+}
+
+CpuGovernor::Clock::time_point CpuGovernor::admit()
+{
+    auto now = Clock::now();
+    if (!enabled()) return now;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill(now);
+    if (credit_ >= 0.0) return now;
+
+    throttled_ = true;
+    return now + std::chrono::microseconds(static_cast<int64_t>(-credit_ / budget_));
+}
+
+void CpuGovernor::record(const void* stream, std::chrono::microseconds cost)
+{
+    if (!enabled()) return;
+
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill(now);
+    credit_ -= static_cast<double>(cost.count());
+    windowCost_ += static_cast<double>(cost.count());
+    windowFrames_++;
+    if (std::find(windowStreams_.begin(), windowStreams_.end(), stream) == windowStreams_.end()) {
+        windowStreams_.push_back(stream);
+    }
+
+    if (now - windowStart_ >= GOVERNOR_WINDOW) {
+        evaluate(now);
+    }
+}
+
+int CpuGovernor::quality(int requested) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::min(requested, GOVERNOR_QUALITY[qualityStep_]);
+}
+
+double CpuGovernor::scale() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return GOVERNOR_SCALE[scaleStep_];
+}
+
+CpuGovernor::Status CpuGovernor::status() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Status status;
+    status.budget = budget_;
+    status.usage = usage_;
+    status.fps = fps_;
+    status.qualityStep = qualityStep_;
+    status.scaleStep = scaleStep_;
+    return status;
+}
+
+void CpuGovernor::refill(Clock::time_point now)
+{
+    double elapsed = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - refilled_).count());
+    double burst = budget_ * std::chrono::microseconds(GOVERNOR_BURST).count();
+    credit_ = std::min(burst, credit_ + elapsed * budget_);
+    refilled_ = now;
+}
+
+void CpuGovernor::evaluate(Clock::time_point now)
+{
+    double seconds = std::chrono::duration<double>(now - windowStart_).count();
+    usage_ = windowCost_ / 1e6 / seconds;
+    fps_ = windowFrames_ / seconds / std::max<size_t>(1, windowStreams_.size());
+
+    if (throttled_ && fps_ < GOVERNOR_MIN_FPS) {
+        if (qualityStep_ + 1 < GOVERNOR_QUALITY.size()) {
+            qualityStep_++;
+        }
+        else if (scaleStep_ + 1 < GOVERNOR_SCALE.size()) {
+            scaleStep_++;
+        }
+    }
+    else if (!throttled_ && usage_ < budget_ * GOVERNOR_RESTORE_USAGE) {
+        if (scaleStep_ > 0) {
+            scaleStep_--;
+        }
+        else if (qualityStep_ > 0) {
+            qualityStep_--;
+        }
+    }
+
+    windowStart_ = now;
+    windowCost_ = 0.0;
+    windowFrames_ = 0;
+    windowStreams_.clear();
+    throttled_ = false;
+}
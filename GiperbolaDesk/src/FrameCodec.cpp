@@ -0,0 +1,755 @@
+#include "../include/FrameCodec.hpp"
+#include <algorithm>
+#include <cstring>
+
+static_assert(CHANGED_BLOCK % TILE_SIZE == 0, "video regions must cover whole tiles");
+
+static RectEncoding rect_encoding(PixelCodec codec, bool tiled)
+{
+    switch (codec) {
+    case PixelCodec::Palette: return tiled ? RectEncoding::TilePalette : RectEncoding::Palette;
+    case PixelCodec::Qoi:     return tiled ? RectEncoding::TileQoi : RectEncoding::Qoi;
+    default:                  return tiled ? RectEncoding::TileJpeg : RectEncoding::Jpeg;
+    }
+}
+
+static PixelCodec pixel_codec(RectEncoding encoding)
+{
+    switch (encoding) {
+    case RectEncoding::Palette:
+    case RectEncoding::TilePalette: return PixelCodec::Palette;
+    case RectEncoding::Qoi:
+    case RectEncoding::TileQoi:     return PixelCodec::Qoi;
+    default:                        return PixelCodec::Jpeg;
+    }
+}
+
+
+// FrameEncoder
+
+// The codecs write into their own vectors, so their output is copied once more here;
+// everything else in the update is written straight into the pooled buffer.
+static FrameBuffer serialize(const FrameUpdate& update)
+{
+    FrameBuffer out = BufferPool::acquire(update.size());
+    update.write(out.data());
+
+    size_t copied = 0;
+    for (auto& rect : update.rects) {
+        copied += rect.data.size() + rect.vectors.size();
+    }
+    BufferPool::count_copy(copied);
+    return out;
+}
+
+FrameEncoder::FrameEncoder(int quality, bool lossless)
+    : quality_(quality), lossless_(lossless) { }
+
+FrameBuffer FrameEncoder::encode(const cv::Mat& frame, uint32_t frameId)
+{
+    StageTimer timer(Stage::Encode);
+
+    FrameUpdate update;
+    update.width = static_cast<uint16_t>(frame.cols);
+    update.height = static_cast<uint16_t>(frame.rows);
+
+    frames_++;
+    frameId_ = frameId;
+    const bool resized = previous_.size() != frame.size();
+    if (resized) {
+        // The viewport is in the old size's pixels; until the viewer reports it again, all is in view.
+        viewport_ = cv::Rect();
+    }
+    const bool streaming = motion_ || !regions_.empty();
+    bool keyframe = resized || keyframeRequested_ ||
+        sinceKeyframe_ >= (streaming ? MOTION_KEYFRAME_INTERVAL : KEYFRAME_INTERVAL);
+    keyframeRequested_ = false;
+
+    // Between refreshes only the video regions are encoded, so the cost follows their size.
+    if (!keyframe && !motion_ && !regions_.empty() && sinceRefresh_ < VIDEO_REFRESH_INTERVAL) {
+        for (auto& region : regions_) {
+            if (inViewport(region.area)) {
+                addMotion(update, frame, region.area, region.reconstructed, false);
+            }
+        }
+        sinceRefresh_++;
+        sinceKeyframe_++;
+        previousId_ = frameId;
+
+        return serialize(update);
+    }
+
+    std::optional<ScrollMatch> scroll;
+    if (!keyframe && regions_.empty()) {
+        scroll = ScrollDetector::detect(previous_, frame);
+    }
+
+    // Scrolls have their own cheap encoding, so they count as calm frames.
+    if (!resized && updateMode(scroll ? 0.0 : MotionCodec::changed_ratio(previous_, frame, &changedBlocks_))) {
+        keyframe = true;
+    }
+    updateRegions(frame, !resized && !scroll && !motion_);
+
+    if (motion_) {
+        addMotion(update, frame, cv::Rect(0, 0, frame.cols, frame.rows), reconstructed_, keyframe);
+    }
+    else if (scroll && !keyframe) {
+        UpdateRect copy;
+        copy.encoding = RectEncoding::CopyRect;
+        copy.x = static_cast<uint16_t>(scroll->target.x);
+        copy.y = static_cast<uint16_t>(scroll->target.y);
+        copy.width = static_cast<uint16_t>(scroll->source.width);
+        copy.height = static_cast<uint16_t>(scroll->source.height);
+        copy.srcX = static_cast<uint16_t>(scroll->source.x);
+        copy.srcY = static_cast<uint16_t>(scroll->source.y);
+        update.baseFrameId = previousId_;
+        update.rects.push_back(std::move(copy));
+
+        previous_.copyTo(predicted_);
+        previous_(scroll->source).copyTo(predicted_(cv::Rect(scroll->target, scroll->source.size())));
+        addDirtyBands(update, predicted_, frame);
+    }
+    else {
+        for (auto& region : regions_) {
+            addMotion(update, frame, region.area, region.reconstructed, keyframe);
+        }
+        addTiles(update, frame, keyframe);
+        if (!keyframe) {
+            refineTiles(update, frame);
+        }
+    }
+    sinceKeyframe_ = keyframe ? 1 : sinceKeyframe_ + 1;
+    sinceRefresh_ = 1;
+
+    // Captures come in fresh buffers, so the reference frame shares the pixels instead of copying them.
+    previous_ = frame;
+    previousId_ = frameId;
+
+    if (!sentNow_.empty()) {
+        unacked_.emplace_back(frameId, std::move(sentNow_));
+        sentNow_.clear();
+        if (unacked_.size() > UNACKED_FRAMES) unacked_.pop_front();
+    }
+
+    return serialize(update);
+}
+
+const TileCacheStats& FrameEncoder::cache_stats() const
+{
+    return stats_;
+}
+
+void FrameEncoder::request_keyframe()
+{
+    keyframeRequested_ = true;
+}
+
+// Tiles sent again since that frame wait for the ack of their own frame.
+// An empty area, or one covering the whole frame, means the viewer sees everything.
+void FrameEncoder::set_viewport(const cv::Rect& area)
+{
+    viewport_ = area;
+}
+
+void FrameEncoder::set_quality(int quality)
+{
+    quality_ = quality;
+}
+
+void FrameEncoder::confirm_frame(uint32_t frameId)
+{
+    auto it = std::find_if(unacked_.begin(), unacked_.end(), [&](const auto& frame) { return frame.first == frameId; });
+    if (it == unacked_.end()) return;
+
+    for (auto& hash : it->second) {
+        SentTile* tile = sent_.peek(hash);
+        if (tile && tile->frameId == frameId) tile->confirmed = true;
+    }
+    unacked_.erase(it);
+}
+
+bool FrameEncoder::motion_mode() const
+{
+    return motion_;
+}
+
+std::vector<cv::Rect> FrameEncoder::video_regions() const
+{
+    std::vector<cv::Rect> areas;
+    for (auto& region : regions_) {
+        areas.push_back(region.area);
+    }
+    return areas;
+}
+
+void FrameEncoder::seed_cache(const std::vector<CacheEntry>& entries)
+{
+    sent_.clear();
+    unacked_.clear();
+    for (auto& entry : entries) {
+        sent_.insert(entry.hash, SentTile{ entry.cost, true, entry.exact ? RefineLevel::Exact : RefineLevel::Draft, 0 });
+    }
+}
+
+// Returns false when synthetic pixels need more colours than one palette holds.
+bool FrameEncoder::addPixels(FrameUpdate& update, const cv::Mat& frame, const cv::Rect& area, ImageClass imageClass,
+    bool tiled, RefineLevel level)
+{
+    PixelCodec codec = imageClass == ImageClass::Synthetic ? PixelCodec::Palette
+        : lossless_ || level == RefineLevel::Exact ? PixelCodec::Qoi : PixelCodec::Jpeg;
+    int quality = level == RefineLevel::Draft ? std::min(quality_, DRAFT_QUALITY) : quality_;
+
+    UpdateRect rect;
+    rect.encoding = rect_encoding(codec, tiled);
+    rect.x = static_cast<uint16_t>(area.x);
+    rect.y = static_cast<uint16_t>(area.y);
+    rect.width = static_cast<uint16_t>(area.width);
+    rect.height = static_cast<uint16_t>(area.height);
+    if (!Codec::encode(codec, frame(area), rect.data, quality)) return false;
+
+    update.rects.push_back(std::move(rect));
+    return true;
+}
+
+void FrameEncoder::addDirtyBands(FrameUpdate& update, const cv::Mat& reference, const cv::Mat& frame)
+{
+    const size_t rowBytes = static_cast<size_t>(frame.cols) * frame.elemSize();
+    auto differs = [&](int y) {
+        return std::memcmp(reference.ptr<uint8_t>(y), frame.ptr<uint8_t>(y), rowBytes) != 0;
+    };
+
+    int y = 0;
+    while (y < frame.rows) {
+        if (!differs(y)) {
+            y++;
+            continue;
+        }
+
+        int top = y, bottom = y;
+        for (int gap = 0; ++y < frame.rows && gap <= DIRTY_BAND_GAP; ) {
+            if (differs(y)) {
+                bottom = y;
+                gap = 0;
+            }
+            else {
+                gap++;
+            }
+        }
+
+        cv::Rect band(0, top, frame.cols, bottom - top + 1);
+        cv::Rect dirty = ScrollDetector::changed_area(reference(band), frame(band));
+        cv::Rect area(dirty.x, top, dirty.width, band.height);
+        addPixels(update, frame, area, Codec::classify(frame(area)));
+        y = bottom + 1;
+    }
+}
+
+void FrameEncoder::addTiles(FrameUpdate& update, const cv::Mat& frame, bool keyframe)
+{
+    const int cols = (frame.cols + TILE_SIZE - 1) / TILE_SIZE;
+    const size_t tiles = static_cast<size_t>(cols) * ((frame.rows + TILE_SIZE - 1) / TILE_SIZE);
+    if (grid_.size() != tiles) {
+        grid_.assign(tiles, GridTile{ TileHash{}, frames_ });
+    }
+    refine_.clear();
+    const bool everywhere = keyframe || ++sinceOutside_ >= VIEWPORT_REFRESH_INTERVAL;
+    if (everywhere) sinceOutside_ = 0;
+
+    std::vector<TileHash> run;
+    ImageClass runClass = ImageClass::Natural;
+    RefineLevel runLevel = RefineLevel::Draft;
+    for (int y = 0; y < frame.rows; y += TILE_SIZE) {
+        int height = std::min(TILE_SIZE, frame.rows - y);
+        int runStart = 0;
+
+        for (int x = 0; x < frame.cols; x += TILE_SIZE) {
+            cv::Rect area(x, y, std::min(TILE_SIZE, frame.cols - x), height);
+            const bool visible = inViewport(area);
+            if (inRegion(area) || (!everywhere && !visible)) {
+                addTileRun(update, frame, cv::Rect(runStart, y, x - runStart, height), run, runClass, runLevel);
+                continue;
+            }
+
+            TileHash hash = tile_hash(frame(area));
+            GridTile& cell = grid_[static_cast<size_t>(y / TILE_SIZE) * cols + x / TILE_SIZE];
+            if (!(cell.hash == hash)) {
+                cell.hash = hash;
+                cell.changedAt = frames_;
+            }
+
+            // The viewer caches a run only when it reaches it, so the run goes out
+            // before the reference and the lookup is repeated in that same order.
+            const SentTile* known = sent_.peek(hash);
+            std::optional<RefineLevel> knownLevel;
+            if (known) knownLevel = known->level;
+            if (known && (!keyframe || known->confirmed)) {
+                addTileRun(update, frame, cv::Rect(runStart, y, x - runStart, height), run, runClass, runLevel);
+                if (SentTile* tile = sent_.find(hash)) {
+                    UpdateRect rect;
+                    rect.encoding = RectEncoding::CachedTile;
+                    rect.x = static_cast<uint16_t>(area.x);
+                    rect.y = static_cast<uint16_t>(area.y);
+                    rect.width = static_cast<uint16_t>(area.width);
+                    rect.height = static_cast<uint16_t>(area.height);
+                    rect.hashes.push_back(hash);
+                    update.rects.push_back(std::move(rect));
+
+                    uint64_t saved = tile->cost > CACHED_TILE_COST ? tile->cost - CACHED_TILE_COST : 0;
+                    stats_.hits++;
+                    stats_.bytesSaved += saved;
+                    Stats::add(Counter::TileHits);
+                    Stats::add(Counter::TileBytesSaved, saved);
+
+                    const uint64_t still = frames_ - cell.changedAt;
+                    RefineLevel target = still >= REFINE_EXACT_FRAMES ? RefineLevel::Exact
+                        : still >= REFINE_SHARP_FRAMES ? (lossless_ ? RefineLevel::Exact : RefineLevel::Sharp) : RefineLevel::Draft;
+                    if (target > tile->level && visible) {
+                        refine_.push_back(Refinement{ area, hash, target });
+                    }
+                    continue;
+                }
+            }
+
+            // A tile sent again keeps the quality the viewer last had for it.
+            ImageClass imageClass = Codec::classify(frame(area));
+            RefineLevel level = knownLevel ? *knownLevel : firstLevel(imageClass);
+            if (!run.empty() && (imageClass != runClass || level != runLevel)) {
+                addTileRun(update, frame, cv::Rect(runStart, y, x - runStart, height), run, runClass, runLevel);
+            }
+            if (run.empty()) {
+                runStart = x;
+                runClass = imageClass;
+                runLevel = level;
+            }
+            run.push_back(hash);
+        }
+
+        addTileRun(update, frame, cv::Rect(runStart, y, frame.cols - runStart, height), run, runClass, runLevel);
+    }
+}
+
+void FrameEncoder::addTileRun(FrameUpdate& update, const cv::Mat& frame, const cv::Rect& area,
+    std::vector<TileHash>& hashes, ImageClass imageClass, RefineLevel level)
+{
+    if (hashes.empty()) return;
+
+    if (!addPixels(update, frame, area, imageClass, true, level)) {
+        if (imageClass != ImageClass::Synthetic || hashes.size() == 1) {
+            hashes.clear();
+            return;
+        }
+
+        // Every tile fits a palette on its own, only the whole run does not.
+        std::vector<TileHash> single;
+        for (size_t i = 0; i < hashes.size(); i++) {
+            int x = area.x + static_cast<int>(i) * TILE_SIZE;
+            single.assign(1, hashes[i]);
+            addTileRun(update, frame, cv::Rect(x, area.y, std::min(TILE_SIZE, area.x + area.width - x), area.height),
+                single, imageClass, level);
+        }
+        hashes.clear();
+        return;
+    }
+
+    UpdateRect& rect = update.rects.back();
+    rect.hashes = std::move(hashes);
+    hashes.clear();
+
+    markSent(rect.hashes, static_cast<uint32_t>(rect.payload_size() / rect.hashes.size() + FrameUpdate::RECT_SIZE), level);
+
+    stats_.misses += rect.hashes.size();
+    Stats::add(Counter::TileMisses, rect.hashes.size());
+}
+
+// Refinements come after everything else in the frame and resend tiles the viewer
+// already holds under the same hash, so they never cost it a cache entry. Up to
+// REFINE_RUN_TILES neighbours on a row share one JPEG header; QOI has no header to
+// share, so exact tiles go one by one and overshoot the budget by at most one tile.
+void FrameEncoder::refineTiles(FrameUpdate& update, const cv::Mat& frame)
+{
+    size_t bytes = 0;
+    for (auto& rect : update.rects) {
+        bytes += FrameUpdate::RECT_SIZE + rect.payload_size();
+    }
+
+    size_t next = 0;
+    while (next < refine_.size() && bytes < REFINE_FRAME_BYTES) {
+        const Refinement& first = refine_[next];
+        cv::Rect area = first.area;
+        std::vector<TileHash> hashes{ first.hash };
+        const size_t runTiles = first.level == RefineLevel::Exact ? 1 : REFINE_RUN_TILES;
+        for (next++; next < refine_.size() && hashes.size() < runTiles; next++) {
+            const Refinement& tile = refine_[next];
+            if (tile.level != first.level || tile.area.y != area.y || tile.area.x != area.x + area.width) break;
+            area.width += tile.area.width;
+            hashes.push_back(tile.hash);
+        }
+
+        if (!addPixels(update, frame, area, ImageClass::Natural, true, first.level)) break;
+
+        UpdateRect& rect = update.rects.back();
+        rect.hashes = std::move(hashes);
+        bytes += FrameUpdate::RECT_SIZE + rect.payload_size();
+
+        markSent(rect.hashes, static_cast<uint32_t>(rect.payload_size() / rect.hashes.size() + FrameUpdate::RECT_SIZE), first.level);
+
+        stats_.refined += rect.hashes.size();
+        Stats::add(Counter::TilesRefined, rect.hashes.size());
+    }
+}
+
+RefineLevel FrameEncoder::firstLevel(ImageClass imageClass) const
+{
+    return imageClass == ImageClass::Synthetic || lossless_ ? RefineLevel::Exact : RefineLevel::Draft;
+}
+
+// Sent pixels are unconfirmed until the viewer acknowledges this frame, so a keyframe
+// sends them again if the frame, refinements included, got lost.
+void FrameEncoder::markSent(const std::vector<TileHash>& hashes, uint32_t cost, RefineLevel level)
+{
+    for (auto& hash : hashes) {
+        sent_.insert(hash, SentTile{ cost, false, level, frameId_ });
+        sentNow_.push_back(hash);
+    }
+}
+
+void FrameEncoder::addMotion(FrameUpdate& update, const cv::Mat& frame, const cv::Rect& area, cv::Mat& reconstructed, bool keyframe)
+{
+    UpdateRect rect;
+    rect.x = static_cast<uint16_t>(area.x);
+    rect.y = static_cast<uint16_t>(area.y);
+    rect.width = static_cast<uint16_t>(area.width);
+    rect.height = static_cast<uint16_t>(area.height);
+    const cv::Mat pixels = frame(area);
+
+    // Predictions start from the decoded JPEG, exactly what the viewer holds, so
+    // quantisation errors do not pile up from frame to frame.
+    if (keyframe || reconstructed.empty()) {
+        rect.encoding = RectEncoding::Jpeg;
+        rect.data = Codec::encode_jpg(pixels, quality_);
+        reconstructed = Codec::decode_jpg(rect.data.data(), rect.data.size());
+    }
+    else {
+        MotionField field = MotionCodec::estimate(reconstructed, pixels);
+        MotionCodec::predict(reconstructed, field, prediction_);
+        MotionCodec::residual(pixels, prediction_, residual_);
+
+        rect.encoding = RectEncoding::Motion;
+        rect.blockSize = static_cast<uint8_t>(field.blockSize);
+        rect.vectors = std::move(field.vectors);
+        rect.data = Codec::encode_jpg(residual_, quality_);
+        MotionCodec::reconstruct(prediction_, Codec::decode_jpg(rect.data.data(), rect.data.size()));
+        std::swap(reconstructed, prediction_);
+        update.baseFrameId = previousId_;
+    }
+    update.rects.push_back(std::move(rect));
+}
+
+// Returns true when the mode flips; either way the viewer then needs a keyframe.
+bool FrameEncoder::updateMode(double changedRatio)
+{
+    if (lossless_) return false;
+
+    bool towards = motion_ ? changedRatio < MOTION_EXIT_RATIO : changedRatio >= MOTION_ENTER_RATIO;
+    modeFrames_ = towards ? modeFrames_ + 1 : 0;
+    if (modeFrames_ < (motion_ ? MOTION_EXIT_FRAMES : MOTION_ENTER_FRAMES)) return false;
+
+    motion_ = !motion_;
+    modeFrames_ = 0;
+    reconstructed_.release();
+    return true;
+}
+
+// A region that keeps its rectangle keeps its reconstruction; new or moved ones start
+// over with a JPEG.
+void FrameEncoder::updateRegions(const cv::Mat& frame, bool track)
+{
+    if (!track || lossless_) {
+        tracker_.reset();
+        regions_.clear();
+        return;
+    }
+
+    std::vector<VideoRegion> regions;
+    for (auto& area : tracker_.update(changedBlocks_, frame.size())) {
+        auto same = std::find_if(regions_.begin(), regions_.end(), [&](const VideoRegion& region) { return region.area == area; });
+        regions.push_back(same != regions_.end() ? std::move(*same) : VideoRegion{ area, cv::Mat() });
+    }
+    regions_ = std::move(regions);
+}
+
+bool FrameEncoder::inRegion(const cv::Rect& tile) const
+{
+    for (auto& region : regions_) {
+        if (region.area.contains(tile.tl())) return true;
+    }
+    return false;
+}
+
+bool FrameEncoder::inViewport(const cv::Rect& area) const
+{
+    return viewport_.empty() || (viewport_ & area).area() > 0;
+}
+
+
+// FrameDecoder
+
+FrameDecoder::FrameDecoder()
+{
+    for (uint32_t slot = static_cast<uint32_t>(store_.capacity()); slot > 0; slot--) {
+        freeSlots_.push_back(slot - 1);
+    }
+}
+
+bool FrameDecoder::apply(const uint8_t* data, size_t size, uint32_t frameId)
+{
+    if (!update_.read(data, size)) return false;
+
+    if (update_.baseFrameId != 0 &&
+        (update_.baseFrameId != frameId_ || update_.width != width_ || update_.height != height_)) {
+        return false;
+    }
+
+    if (update_.width != width_ || update_.height != height_) {
+        width_ = update_.width;
+        height_ = update_.height;
+        canvas_.assign(static_cast<size_t>(width_) * height_ * 4, 0);
+    }
+
+    for (auto& rect : update_.rects) {
+        bool ok = false;
+        switch (rect.encoding) {
+        case RectEncoding::CopyRect:   ok = copyRect(rect); break;
+        case RectEncoding::CachedTile: ok = drawCachedTile(rect); break;
+        case RectEncoding::Motion:     ok = drawMotion(rect); break;
+        default:                       ok = drawPixels(rect); break;
+        }
+        if (!ok) {
+            frameId_ = 0;
+            return false;
+        }
+    }
+
+    frameId_ = frameId;
+    return true;
+}
+
+const std::vector<uint8_t>& FrameDecoder::pixels() const
+{
+    return canvas_;
+}
+
+int FrameDecoder::width() const
+{
+    return width_;
+}
+
+int FrameDecoder::height() const
+{
+    return height_;
+}
+
+const TileCacheStats& FrameDecoder::cache_stats() const
+{
+    return stats_;
+}
+
+bool FrameDecoder::attach_store(const std::string& path)
+{
+    if (!store_.open(path)) return false;
+
+    loadSlots();
+    return true;
+}
+
+std::vector<CacheEntry> FrameDecoder::cached_tiles() const
+{
+    std::vector<CacheEntry> entries;
+    for (auto& hash : tiles_.keys()) {
+        const CachedTile* tile = tiles_.peek(hash);
+        entries.push_back(CacheEntry{ hash, tile->cost, tile->exact });
+    }
+    return entries;
+}
+
+bool FrameDecoder::drawPixels(const UpdateRect& rect)
+{
+    if (rect.x + rect.width > width_ || rect.y + rect.height > height_) return false;
+
+    const int w = rect.width, h = rect.height;
+    if (!Codec::decode(pixel_codec(rect.encoding), rect.data.data(), rect.data.size(), w, h, scratch_)) return false;
+
+    const size_t rowBytes = static_cast<size_t>(w) * 4;
+    for (int r = 0; r < h; r++) {
+        std::memcpy(canvas_.data() + ((static_cast<size_t>(rect.y) + r) * width_ + rect.x) * 4,
+            scratch_.data() + r * rowBytes, rowBytes);
+    }
+
+    if (!rect.hashes.empty()) {
+        storeTiles(rect);
+    }
+    return true;
+}
+
+void FrameDecoder::storeTiles(const UpdateRect& rect)
+{
+    uint32_t cost = static_cast<uint32_t>(rect.payload_size() / std::max<size_t>(rect.hashes.size(), 1) + FrameUpdate::RECT_SIZE);
+    const bool exact = pixel_codec(rect.encoding) != PixelCodec::Jpeg;
+    bool reloaded = false;
+    for (size_t i = 0; i < rect.hashes.size(); i++) {
+        int x = static_cast<int>(i) * TILE_SIZE;
+        if (x >= rect.width || rect.height > TILE_SIZE) break;
+
+        const TileHash& hash = rect.hashes[i];
+        CachedTile tile{ 0, cost, exact };
+        if (const CachedTile* existing = tiles_.peek(hash)) {
+            tile.slot = existing->slot;
+            tiles_.insert(hash, tile);
+        }
+        else if (!freeSlots_.empty()) {
+            tile.slot = freeSlots_.back();
+            freeSlots_.pop_back();
+            tiles_.insert(hash, tile);
+        }
+        else {
+            auto evicted = tiles_.insert(hash, tile);
+            if (!evicted) {
+                // Full store but a cache with room: the two disagree, so start over from the
+                // store and place the tile again. The host counts on the viewer holding it.
+                if (!reloaded) {
+                    reloaded = true;
+                    loadSlots();
+                    i--;
+                }
+                continue;
+            }
+            tile.slot = evicted->slot;
+            tiles_.find(hash)->slot = tile.slot;
+        }
+
+        int w = std::min(TILE_SIZE, rect.width - x);
+        TileStore::Entry& entry = store_.entry(tile.slot);
+        entry.hash = hash;
+        entry.width = static_cast<uint16_t>(w);
+        entry.height = rect.height;
+        entry.exact = exact ? 1 : 0;
+        entry.cost = cost;
+        entry.stamp = store_.next_stamp();
+
+        uint8_t* pixels = store_.pixels(tile.slot);
+        for (int r = 0; r < rect.height; r++) {
+            std::memcpy(pixels + static_cast<size_t>(r) * w * 4,
+                scratch_.data() + (static_cast<size_t>(r) * rect.width + x) * 4, static_cast<size_t>(w) * 4);
+        }
+    }
+    stats_.misses += rect.hashes.size();
+}
+
+// Rebuilds the LRU from the store's stamps so it matches the order the previous session
+// left. The file comes from disk as-is: entries with an impossible size or a hash already
+// seen are dropped, so every slot ends up either in tiles_ or in freeSlots_.
+void FrameDecoder::loadSlots()
+{
+    std::vector<std::pair<uint64_t, uint32_t>> used;
+    tiles_.clear();
+    freeSlots_.clear();
+    for (uint32_t slot = 0; slot < store_.capacity(); slot++) {
+        TileStore::Entry& entry = store_.entry(slot);
+        if (entry.stamp == 0) {
+            freeSlots_.push_back(slot);
+        }
+        else if (entry.width < 1 || entry.width > TILE_SIZE || entry.height < 1 || entry.height > TILE_SIZE) {
+            entry = TileStore::Entry{};
+            freeSlots_.push_back(slot);
+        }
+        else {
+            used.emplace_back(entry.stamp, slot);
+        }
+    }
+
+    std::sort(used.begin(), used.end());
+    for (auto& [stamp, slot] : used) {
+        TileStore::Entry& entry = store_.entry(slot);
+        if (tiles_.contains(entry.hash)) {
+            entry = TileStore::Entry{};
+            freeSlots_.push_back(slot);
+            continue;
+        }
+        tiles_.insert(entry.hash, CachedTile{ slot, entry.cost, entry.exact != 0 });
+    }
+}
+
+bool FrameDecoder::drawCachedTile(const UpdateRect& rect)
+{
+    if (rect.x + rect.width > width_ || rect.y + rect.height > height_) return false;
+
+    CachedTile* tile = tiles_.find(rect.hashes.front());
+    if (!tile) {
+        stats_.missing++;
+        return false;
+    }
+
+    TileStore::Entry& entry = store_.entry(tile->slot);
+    if (entry.width != rect.width || entry.height != rect.height || rect.width > TILE_SIZE || rect.height > TILE_SIZE) {
+        stats_.missing++;
+        return false;
+    }
+    entry.stamp = store_.next_stamp();
+
+    const uint8_t* pixels = store_.pixels(tile->slot);
+    const size_t rowBytes = static_cast<size_t>(rect.width) * 4;
+    for (int r = 0; r < rect.height; r++) {
+        std::memcpy(canvas_.data() + ((static_cast<size_t>(rect.y) + r) * width_ + rect.x) * 4,
+            pixels + r * rowBytes, rowBytes);
+    }
+
+    stats_.hits++;
+    stats_.bytesSaved += tile->cost > CACHED_TILE_COST ? tile->cost - CACHED_TILE_COST : 0;
+    return true;
+}
+
+bool FrameDecoder::drawMotion(const UpdateRect& rect)
+{
+    if (rect.x + rect.width > width_ || rect.y + rect.height > height_ || rect.blockSize == 0) return false;
+
+    const int w = rect.width, h = rect.height;
+    if (!Codec::decode(PixelCodec::Jpeg, rect.data.data(), rect.data.size(), w, h, scratch_)) return false;
+
+    MotionField field;
+    field.blockSize = rect.blockSize;
+    field.cols = (w + rect.blockSize - 1) / rect.blockSize;
+    field.rows = (h + rect.blockSize - 1) / rect.blockSize;
+    field.vectors = rect.vectors;
+
+    // Vectors point into the area as it was before this frame, so that is copied out first.
+    cv::Mat canvas = cv::Mat(height_, width_, CV_8UC4, canvas_.data())(cv::Rect(rect.x, rect.y, w, h));
+    reference_.resize(static_cast<size_t>(w) * h * 4);
+    cv::Mat reference(h, w, CV_8UC4, reference_.data());
+    canvas.copyTo(reference);
+    MotionCodec::predict(reference, field, canvas);
+    MotionCodec::reconstruct(canvas, cv::Mat(h, w, CV_8UC4, scratch_.data()));
+    return true;
+}
+
+bool FrameDecoder::copyRect(const UpdateRect& rect)
+{
+    if (rect.x + rect.width > width_ || rect.y + rect.height > height_ ||
+        rect.srcX + rect.width > width_ || rect.srcY + rect.height > height_) {
+        return false;
+    }
+
+    // Source and target overlap while scrolling, so walk rows away from the target.
+    const size_t rowBytes = static_cast<size_t>(rect.width) * 4;
+    auto row = [&](int y, int x) { return canvas_.data() + (static_cast<size_t>(y) * width_ + x) * 4; };
+    if (rect.y > rect.srcY) {
+        for (int r = rect.height - 1; r >= 0; r--) {
+            std::memmove(row(rect.y + r, rect.x), row(rect.srcY + r, rect.srcX), rowBytes);
+        }
+    }
+    else {
+        for (int r = 0; r < rect.height; r++) {
+            std::memmove(row(rect.y + r, rect.x), row(rect.srcY + r, rect.srcX), rowBytes);
+        }
+    }
+    return true;
+}
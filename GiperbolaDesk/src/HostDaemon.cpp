@@ -0,0 +1,253 @@
+#include "../include/HostDaemon.hpp"
+#include <cstdlib>
+
+
+// HostStream
+
+HostStream::HostStream(Network& network, uint8_t streamId, FrameSource source, int quality, bool lossless, int fps,
+    CpuGovernor* governor)
+    : network_(network), streamId_(streamId), source_(std::move(source)), encoder_(quality, lossless),
+      governor_(governor && governor->enabled() ? governor : nullptr), quality_(quality)
+{
+    if (fps > 0) {
+        interval_ = std::chrono::microseconds(1000000 / fps);
+    }
+
+    // Give a returning viewer a moment to list its persisted tiles before the first keyframe.
+    network_.request_tile_cache(streamId_);
+    cacheDeadline_ = std::chrono::steady_clock::now() + CACHE_ANNOUNCE_WAIT;
+}
+
+std::chrono::steady_clock::time_point HostStream::step()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (waitingForCache_) {
+        if (!(entries_ = network_.take_tile_cache(streamId_)) && now < cacheDeadline_) {
+            return now + CACHE_ANNOUNCE_POLL;
+        }
+        waitingForCache_ = false;
+        next_ = now;
+    }
+
+    if (entries_ || (entries_ = network_.take_tile_cache(streamId_))) {
+        encoder_.seed_cache(*entries_);
+        entries_.reset();
+    }
+    if (network_.keyframe_requested(streamId_)) {
+        encoder_.request_keyframe();
+    }
+    network_.take_acks(acks_, streamId_);
+    for (uint32_t acked : acks_) {
+        encoder_.confirm_frame(acked);
+    }
+    if (auto viewport = network_.take_viewport(streamId_)) {
+        encoder_.set_viewport(*viewport);
+    }
+
+    uint32_t frameId = network_.next_frame_id(streamId_);
+    uint64_t captureTime = monotonic_us();
+    cv::Mat img;
+    {
+        TraceSpan span("capture", frameId);
+        img = source_();
+    }
+
+    if (governor_) {
+        encoder_.set_quality(governor_->quality(quality_));
+        double scale = governor_->scale();
+        if (scale < 1.0) {
+            cv::Size size(static_cast<int>(img.cols * scale), static_cast<int>(img.rows * scale));
+            cv::resize(img, img, size, 0, 0, cv::INTER_AREA);
+        }
+    }
+
+    FrameBuffer encoded;
+    {
+        TraceSpan span("encode", frameId);
+        encoded = encoder_.encode(img, frameId);
+    }
+
+    network_.sendFrame(encoded, captureTime, streamId_);
+
+    // Without a frame rate the next capture follows at once; a late frame does not make
+    // the following ones come in a burst.
+    now = std::chrono::steady_clock::now();
+    if (governor_) {
+        governor_->record(this, std::chrono::microseconds(monotonic_us() - captureTime));
+    }
+    next_ = interval_.count() == 0 ? now : std::max(next_ + interval_, now);
+    if (governor_) {
+        next_ = std::max(next_, governor_->admit());
+    }
+    return next_;
+}
+
+
+// SessionConfig
+
+bool parse_session_spec(const std::string& spec, SessionConfig& config)
+{
+    size_t end = spec.find(',');
+    std::string address = spec.substr(0, end);
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+
+    config.viewerIp = address.substr(0, colon);
+    int port = std::atoi(address.c_str() + colon + 1);
+    if (port <= 0 || port > 65535) {
+        return false;
+    }
+    config.viewerPort = static_cast<unsigned int>(port);
+
+    while (end != std::string::npos) {
+        size_t start = end + 1;
+        end = spec.find(',', start);
+        std::string option = spec.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+        if (option == "lossless") {
+            config.lossless = true;
+        }
+        else if (option.rfind("quality=", 0) == 0) {
+            config.quality = std::atoi(option.c_str() + 8);
+            if (config.quality < 1 || config.quality > 100) return false;
+        }
+        else if (option.rfind("fps=", 0) == 0) {
+            config.fps = std::atoi(option.c_str() + 4);
+            if (config.fps < 0) return false;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// HostDaemon
+
+HostDaemon::HostDaemon(FrameSourceFactory sources, std::vector<MonitorInfo> monitors, size_t workers, double cpuBudget)
+    : sources_(std::move(sources)), monitors_(std::move(monitors)), governor_(cpuBudget), pool_(workers) { }
+
+HostDaemon::~HostDaemon()
+{
+    stop();
+}
+
+Network& HostDaemon::add_session(const SessionConfig& config)
+{
+    auto session = std::make_unique<Session>();
+    session->config = config;
+    session->network = std::make_unique<Network>();
+    session->network->open(config.localIp, config.localPort, config.viewerIp, config.viewerPort);
+    session->network->set_monitors(monitors_);
+
+    Session& added = *session;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        sessions_.push_back(std::move(session));
+    }
+    {
+        std::lock_guard<std::mutex> lock(chains_mutex_);
+        chains_++;
+    }
+    pool_.submit([this, &added] { supervise(added); });
+    return *added.network;
+}
+
+// Every chain notices running_ at its next step and ends, so stop() waits at most one
+// frame interval or SUBSCRIPTION_POLL before the sockets close.
+void HostDaemon::stop()
+{
+    if (!running_.exchange(false)) return;
+
+    {
+        std::unique_lock<std::mutex> lock(chains_mutex_);
+        chains_cv_.wait(lock, [&] { return chains_ == 0; });
+    }
+
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (auto& session : sessions_) {
+        session->network->stop();
+    }
+}
+
+size_t HostDaemon::session_count() const
+{
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    return sessions_.size();
+}
+
+Network& HostDaemon::session(size_t index)
+{
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    return *sessions_.at(index)->network;
+}
+
+size_t HostDaemon::worker_count() const
+{
+    return pool_.size();
+}
+
+CpuGovernor::Status HostDaemon::governor_status() const
+{
+    return governor_.status();
+}
+
+// Starts a stream chain for every monitor the viewer newly subscribed to; a chain ends on
+// its own once the viewer drops its stream.
+void HostDaemon::supervise(Session& session)
+{
+    if (!running_) {
+        chainEnded();
+        return;
+    }
+
+    uint8_t wanted = session.network->subscribed_streams();
+    for (uint8_t i = 0; i < monitors_.size() && i < MAX_STREAMS; i++) {
+        if (!(wanted & (1u << i)) || session.active[i]) continue;
+
+        session.streams[i] = std::make_unique<HostStream>(*session.network, i, sources_(monitors_[i]),
+            session.config.quality, session.config.lossless, session.config.fps, &governor_);
+        session.active[i] = true;
+        {
+            std::lock_guard<std::mutex> lock(chains_mutex_);
+            chains_++;
+        }
+        pool_.submit([this, &session, i] { runStream(session, i); });
+    }
+
+    schedule(std::chrono::steady_clock::now() + SUBSCRIPTION_POLL, [this, &session] { supervise(session); });
+}
+
+void HostDaemon::runStream(Session& session, uint8_t streamId)
+{
+    const uint8_t bit = static_cast<uint8_t>(1u << streamId);
+    if (!running_ || !(session.network->subscribed_streams() & bit)) {
+        session.streams[streamId].reset();
+        session.active[streamId] = false;
+        chainEnded();
+        return;
+    }
+
+    auto due = session.streams[streamId]->step();
+    schedule(due, [this, &session, streamId] { runStream(session, streamId); });
+}
+
+void HostDaemon::schedule(std::chrono::steady_clock::time_point due, WorkerPool::Task task)
+{
+    if (due <= std::chrono::steady_clock::now()) {
+        pool_.submit(std::move(task));
+    }
+    else {
+        pool_.submit_at(due, std::move(task));
+    }
+}
+
+void HostDaemon::chainEnded()
+{
+    std::lock_guard<std::mutex> lock(chains_mutex_);
+    chains_--;
+    chains_cv_.notify_all();
+}
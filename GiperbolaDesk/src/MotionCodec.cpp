@@ -0,0 +1,208 @@
+#include "../include/MotionCodec.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+
+// Green channel, sampled every MOTION_SCALE pixels in both directions.
+static cv::Mat thumbnail(const cv::Mat& img)
+{
+    cv::Mat out(img.rows / MOTION_SCALE, img.cols / MOTION_SCALE, CV_8UC1);
+    for (int y = 0; y < out.rows; y++) {
+        const uint8_t* src = img.ptr<uint8_t>(y * MOTION_SCALE);
+        uint8_t* dst = out.ptr<uint8_t>(y);
+        for (int x = 0; x < out.cols; x++) {
+            dst[x] = src[x * MOTION_SCALE * 3 + 1];
+        }
+    }
+    return out;
+}
+
+MotionField MotionCodec::estimate(const cv::Mat& reference, const cv::Mat& frame)
+{
+    MotionField field;
+    field.cols = (frame.cols + MOTION_BLOCK - 1) / MOTION_BLOCK;
+    field.rows = (frame.rows + MOTION_BLOCK - 1) / MOTION_BLOCK;
+    field.vectors.assign(static_cast<size_t>(field.cols) * field.rows * 2, 0);
+
+    const cv::Point global = globalMotion(reference, frame);
+    const cv::Point steps[] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+    for (int row = 0; row < field.rows; row++) {
+        for (int col = 0; col < field.cols; col++) {
+            cv::Rect block(col * MOTION_BLOCK, row * MOTION_BLOCK,
+                std::min(MOTION_BLOCK, frame.cols - col * MOTION_BLOCK), std::min(MOTION_BLOCK, frame.rows - row * MOTION_BLOCK));
+
+            std::vector<cv::Point> candidates = { { 0, 0 }, global };
+            if (col > 0) candidates.emplace_back(field.dx(col - 1, row), field.dy(col - 1, row));
+            if (row > 0) candidates.emplace_back(field.dx(col, row - 1), field.dy(col, row - 1));
+
+            cv::Point best(0, 0);
+            uint32_t bestCost = std::numeric_limits<uint32_t>::max();
+            for (auto& candidate : candidates) {
+                uint32_t cost = blockCost(reference, frame, block, candidate.x, candidate.y);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    best = candidate;
+                }
+            }
+
+            // Small diamond steps until no neighbour is cheaper.
+            for (bool improved = bestCost > 0; improved; ) {
+                improved = false;
+                for (auto& step : steps) {
+                    cv::Point next = best + step;
+                    if (std::abs(next.x) > MOTION_RANGE || std::abs(next.y) > MOTION_RANGE) continue;
+
+                    uint32_t cost = blockCost(reference, frame, block, next.x, next.y);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        best = next;
+                        improved = true;
+                    }
+                }
+            }
+
+            size_t index = (static_cast<size_t>(row) * field.cols + col) * 2;
+            field.vectors[index] = static_cast<int8_t>(best.x);
+            field.vectors[index + 1] = static_cast<int8_t>(best.y);
+        }
+    }
+    return field;
+}
+
+void MotionCodec::predict(const cv::Mat& reference, const MotionField& field, cv::Mat& prediction)
+{
+    prediction.create(reference.size(), reference.type());
+    const int channels = reference.channels();
+
+    for (int row = 0; row < field.rows; row++) {
+        for (int col = 0; col < field.cols; col++) {
+            const int dx = field.dx(col, row), dy = field.dy(col, row);
+            const int x0 = col * field.blockSize, y0 = row * field.blockSize;
+            const int width = std::min(field.blockSize, reference.cols - x0);
+            const int height = std::min(field.blockSize, reference.rows - y0);
+
+            for (int y = y0; y < y0 + height; y++) {
+                const int sy = std::clamp(y + dy, 0, reference.rows - 1);
+                const uint8_t* src = reference.ptr<uint8_t>(sy);
+                uint8_t* dst = prediction.ptr<uint8_t>(y);
+
+                // The part that stays inside the reference is one copy; the rest is clamped.
+                const int inBegin = std::clamp(-dx, x0, x0 + width);
+                const int inEnd = std::clamp(reference.cols - dx, inBegin, x0 + width);
+                for (int x = x0; x < inBegin; x++) {
+                    std::memcpy(dst + x * channels, src, channels);
+                }
+                if (inEnd > inBegin) {
+                    std::memcpy(dst + inBegin * channels, src + (inBegin + dx) * channels,
+                        static_cast<size_t>(inEnd - inBegin) * channels);
+                }
+                for (int x = inEnd; x < x0 + width; x++) {
+                    std::memcpy(dst + x * channels, src + (reference.cols - 1) * channels, channels);
+                }
+            }
+        }
+    }
+}
+
+void MotionCodec::residual(const cv::Mat& frame, const cv::Mat& prediction, cv::Mat& out)
+{
+    out.create(frame.size(), CV_8UC3);
+    const int channels = prediction.channels();
+    for (int y = 0; y < frame.rows; y++) {
+        const uint8_t* f = frame.ptr<uint8_t>(y);
+        const uint8_t* p = prediction.ptr<uint8_t>(y);
+        uint8_t* o = out.ptr<uint8_t>(y);
+        for (int x = 0; x < frame.cols; x++) {
+            for (int c = 0; c < 3; c++) {
+                int diff = f[x * 3 + c] - p[x * channels + c];
+                o[x * 3 + c] = static_cast<uint8_t>(std::clamp(128 + diff / RESIDUAL_SCALE, 0, 255));
+            }
+        }
+    }
+}
+
+void MotionCodec::reconstruct(cv::Mat& prediction, const cv::Mat& residual)
+{
+    const int channels = prediction.channels();
+    const int residualChannels = residual.channels();
+    for (int y = 0; y < prediction.rows; y++) {
+        uint8_t* p = prediction.ptr<uint8_t>(y);
+        const uint8_t* r = residual.ptr<uint8_t>(y);
+        for (int x = 0; x < prediction.cols; x++) {
+            for (int c = 0; c < 3; c++) {
+                int value = p[x * channels + c] + (r[x * residualChannels + c] - 128) * RESIDUAL_SCALE;
+                p[x * channels + c] = static_cast<uint8_t>(std::clamp(value, 0, 255));
+            }
+        }
+    }
+}
+
+// Optionally reports every CHANGED_BLOCK block, row by row, as changed (1) or not (0).
+double MotionCodec::changed_ratio(const cv::Mat& previous, const cv::Mat& current, std::vector<uint8_t>* blocks)
+{
+    if (blocks) blocks->clear();
+    if (previous.size() != current.size() || previous.type() != current.type()) return 1.0;
+
+    size_t changed = 0, total = 0;
+    const size_t pixelBytes = current.elemSize();
+    for (int y = 0; y < current.rows; y += CHANGED_BLOCK) {
+        const int height = std::min(CHANGED_BLOCK, current.rows - y);
+        for (int x = 0; x < current.cols; x += CHANGED_BLOCK) {
+            const size_t bytes = static_cast<size_t>(std::min(CHANGED_BLOCK, current.cols - x)) * pixelBytes;
+            total++;
+            bool differs = false;
+            for (int r = y; r < y + height && !differs; r++) {
+                differs = std::memcmp(previous.ptr<uint8_t>(r) + x * pixelBytes, current.ptr<uint8_t>(r) + x * pixelBytes, bytes) != 0;
+            }
+            changed += differs;
+            if (blocks) blocks->push_back(differs);
+        }
+    }
+    return total ? static_cast<double>(changed) / total : 0.0;
+}
+
+cv::Point MotionCodec::globalMotion(const cv::Mat& reference, const cv::Mat& frame)
+{
+    cv::Mat before = thumbnail(reference), after = thumbnail(frame);
+    const int range = MOTION_RANGE / MOTION_SCALE;
+    if (after.cols <= 2 * range || after.rows <= 2 * range) return cv::Point(0, 0);
+
+    cv::Point best(0, 0);
+    uint64_t bestCost = std::numeric_limits<uint64_t>::max();
+    for (int dy = -range; dy <= range; dy++) {
+        for (int dx = -range; dx <= range; dx++) {
+            uint64_t cost = 0;
+            for (int y = range; y < after.rows - range; y++) {
+                const uint8_t* a = after.ptr<uint8_t>(y);
+                const uint8_t* b = before.ptr<uint8_t>(y + dy);
+                for (int x = range; x < after.cols - range; x++) {
+                    cost += std::abs(a[x] - b[x + dx]);
+                }
+            }
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = cv::Point(dx, dy);
+            }
+        }
+    }
+    return best * MOTION_SCALE;
+}
+
+// Sum of absolute green differences over every other row and column of the block,
+// with the displaced block clamped to the reference like predict() does.
+uint32_t MotionCodec::blockCost(const cv::Mat& reference, const cv::Mat& frame, const cv::Rect& block, int dx, int dy)
+{
+    uint32_t cost = 0;
+    for (int y = block.y; y < block.y + block.height; y += 2) {
+        const uint8_t* a = frame.ptr<uint8_t>(y);
+        const uint8_t* b = reference.ptr<uint8_t>(std::clamp(y + dy, 0, reference.rows - 1));
+        for (int x = block.x; x < block.x + block.width; x += 2) {
+            int sx = std::clamp(x + dx, 0, reference.cols - 1);
+            cost += std::abs(a[x * 3 + 1] - b[sx * 3 + 1]);
+        }
+    }
+    return cost;
+}
@@ -1,5 +1,12 @@
 ﻿#include "../include/Network.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#ifdef _WIN32
+#include "../include/HostDaemon.hpp"
+#include "../include/ScreenManager.hpp"
 #include "../include/ScreenViewer.hpp"
+#endif
 
 
 Network::Network()
@@ -10,170 +17,581 @@ Network::~Network()
     stop();
 }
 
-void Network::init(const std::string& local_ip, unsigned int local_port)
+// DSCP asks routers to queue the datagrams by class; Windows applies IP_TOS only where a
+// QoS policy allows it, elsewhere the marking is simply not set.
+static SOCKET open_socket(const sockaddr_in& address, int dscp, int receiveBuffer)
 {
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        throw std::runtime_error("WSAStartup failed");
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    int tos = dscp << 2;
+    setsockopt(s, IPPROTO_IP, IP_TOS, reinterpret_cast<const char*>(&tos), sizeof(tos));
+    if (receiveBuffer > 0) {
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&receiveBuffer), sizeof(receiveBuffer));
     }
 
-    socket_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (socket_ == INVALID_SOCKET) {
-        WSACleanup();
-        throw std::runtime_error("Failed to create socket");
+    if (bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+void Network::init(const std::string& local_ip, unsigned int local_port)
+{
+    if (!socket_startup()) {
+        throw std::runtime_error("WSAStartup failed");
     }
 
     localAddr_.sin_family = AF_INET;
     localAddr_.sin_port = htons(local_port);
     if (InetPtonA(AF_INET, local_ip.c_str(), &localAddr_.sin_addr) != 1) {
-        closesocket(socket_);
-        WSACleanup();
+        socket_cleanup();
         throw std::runtime_error("Invalid IP address");
     }
+    sockaddr_in controlAddr = localAddr_;
+    controlAddr.sin_port = htons(static_cast<uint16_t>(local_port + CONTROL_PORT_OFFSET));
 
-    if (bind(socket_, (sockaddr*)&localAddr_, sizeof(localAddr_)) == SOCKET_ERROR) {
-        closesocket(socket_);
-        WSACleanup();
+    // Keyframes of several monitors can arrive back to back; the default buffer drops them.
+    // Control traffic has a socket of its own, so it never waits behind queued chunks.
+    socket_ = open_socket(localAddr_, FRAME_DSCP, static_cast<int>(SOCKET_BUFFER_SIZE));
+    control_ = open_socket(controlAddr, CONTROL_DSCP, 0);
+    if (socket_ == INVALID_SOCKET || control_ == INVALID_SOCKET) {
+        if (socket_ != INVALID_SOCKET) closesocket(socket_);
+        if (control_ != INVALID_SOCKET) closesocket(control_);
+        socket_ = control_ = INVALID_SOCKET;
+        socket_cleanup();
         throw std::runtime_error("Bind failed");
     }
+
+    opened_ = true;
 }
 
-void Network::start(bool demonstration, const std::string& local_ip, unsigned int local_port,
+void Network::open(const std::string& local_ip, unsigned int local_port,
     const std::string& ip_recipient, unsigned int port_recipient)
 {
     this->local_ip = local_ip;
     this->local_port = local_port;
     this->ip_recipient = ip_recipient;
     this->port_recipient = port_recipient;
+    remoteValid_ = make_address(ip_recipient, port_recipient, remoteAddr_) &&
+        make_address(ip_recipient, port_recipient + CONTROL_PORT_OFFSET, controlAddr_);
+    do {
+        sessionId_ = std::random_device()();
+    } while (sessionId_ == 0);
 
     init(local_ip, local_port);
     startReceiving();
+}
+
+#ifdef _WIN32
+void Network::start(bool demonstration, const std::string& local_ip, unsigned int local_port,
+    const std::string& ip_recipient, unsigned int port_recipient)
+{
+    const char* tracePath = std::getenv(TRACE_ENV);
+    if (tracePath) {
+        Trace::enable();
+        Trace::name_thread(demonstration ? "capture" : "viewer");
+    }
+
+    open(local_ip, local_port, ip_recipient, port_recipient);
+    Stats::start_reporter(STATS_FILE, STATS_INTERVAL,
+        local_ip + ":" + std::to_string(local_port) + " <-> " + ip_recipient + ":" + std::to_string(port_recipient));
 
     if (!demonstration) {
-        ScreenViewer viewer_;
-        while (viewer_.is_open() && running_) {
-            if (!viewer_.poll_events(this)) {
-                break;
+        // One window per subscribed monitor; closing a window drops that stream.
+        struct ViewedStream
+        {
+            std::unique_ptr<ScreenViewer> viewer;
+            std::chrono::steady_clock::time_point lastAnnounce;
+            std::chrono::steady_clock::time_point lastKeyframeRequest;
+            uint64_t announcedMissing = 0;
+            uint32_t lastShown = 0;
+        };
+
+        uint8_t wanted = parse_stream_mask(std::getenv(MONITORS_ENV));
+        auto last_sync = std::chrono::steady_clock::now() - CLOCK_SYNC_INTERVAL;
+        std::array<ViewedStream, MAX_STREAMS> views;
+        uint32_t shownSession = 0;
+        for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+            if (!(wanted & (1u << i))) continue;
+            views[i].viewer = std::make_unique<ScreenViewer>(i);
+            views[i].viewer->attach_tile_store(tile_store_path(ip_recipient, port_recipient, i));
+            views[i].lastAnnounce = views[i].lastKeyframeRequest = last_sync;
+        }
+
+        while (wanted != 0 && running_) {
+            for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+                if (views[i].viewer && !views[i].viewer->poll_events(this)) {
+                    views[i].viewer.reset();
+                    wanted &= ~(1u << i);
+                    subscribe(wanted);
+                }
+            }
+            // Everything the windows produced in this pass leaves in one datagram.
+            flush_events();
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_sync >= CLOCK_SYNC_INTERVAL) {
+                sync_clock();
+                subscribe(wanted);
+                for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+                    if (views[i].viewer) send_viewport(views[i].viewer->viewport(), i);
+                }
+                last_sync = now;
+            }
+
+            for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+                ViewedStream& view = views[i];
+                if (!view.viewer) continue;
+
+                // Re-announce when the host asks, or when it referenced tiles we no longer hold.
+                bool resync = view.viewer->missing_tiles() != view.announcedMissing && now - view.lastAnnounce >= CACHE_ANNOUNCE_INTERVAL;
+                if (tile_cache_requested(i) || resync) {
+                    send_tile_cache(view.viewer->cached_tiles(), i);
+                    view.announcedMissing = view.viewer->missing_tiles();
+                    view.lastAnnounce = now;
+                }
+
+                view.viewer->update_overlay(stats());
             }
 
-            if (auto frame = get_frame()) {
-                viewer_.display_frame(frame);
+            // At most one frame per open window per pass, so one busy monitor cannot starve the others.
+            for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+                if (!views[i].viewer) continue;
+                auto frame = get_frame();
+                if (!frame) break;
+
+                // Frames of any other sender are dropped until the host we show goes quiet, e.g. to restart.
+                if (frame->session != shownSession) {
+                    if (session_active(shownSession)) continue;
+                    shownSession = frame->session;
+                }
+
+                ViewedStream& view = views[frame->streamId];
+                if (!view.viewer) continue;
+                if (view.viewer->display_frame(*frame, this)) {
+                    view.lastShown = frame->frameId;
+                    ack_frame(frame->frameId, frame->streamId);
+                    frame_presented(*frame);
+                }
+                else if (now - view.lastKeyframeRequest >= KEYFRAME_REQUEST_INTERVAL) {
+                    request_keyframe(view.lastShown, frame->streamId);
+                    view.lastKeyframeRequest = now;
+                }
             }
         }
     }
     else {
+        std::vector<MonitorInfo> monitors = ScreenManager::monitors();
+        set_monitors(monitors);
+        CpuGovernor governor(parse_cpu_budget(std::getenv(CPU_BUDGET_ENV)));
+
+        // A capture thread per subscribed monitor; a thread ends on its own once the viewer drops its stream.
+        std::array<std::thread, MAX_STREAMS> pipelines;
         while (running_) {
-            sendFrame(ScreenManager::capture_screen_as_jpg());
+            uint8_t wanted = subscribed_streams();
+            for (uint8_t i = 0; i < monitors.size(); i++) {
+                if (pipelines[i].joinable() && !streams_[i].active) {
+                    pipelines[i].join();
+                }
+                if ((wanted & (1u << i)) && !pipelines[i].joinable()) {
+                    streams_[i].active = true;
+                    pipelines[i] = std::thread(&Network::streamMonitor, this, monitors[i], i, &governor);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+
+        for (auto& pipeline : pipelines) {
+            if (pipeline.joinable()) pipeline.join();
         }
     }
+
+    // The loop ends when stop() is called from another thread, which may still be joining
+    // ours; stopping here waits for that, so no thread writes the ring while it is flushed.
+    stop();
+    Stats::stop_reporter();
+    if (tracePath) {
+        Trace::disable();
+        Trace::flush(tracePath);
+    }
 }
 
+void Network::streamMonitor(const MonitorInfo& monitor, uint8_t streamId, CpuGovernor* governor)
+{
+    Trace::name_thread("capture " + std::to_string(streamId));
+    const uint8_t bit = static_cast<uint8_t>(1u << streamId);
+
+    HostStream stream(*this, streamId, [&] { return ScreenManager::capture_monitor(monitor); },
+        HOST_QUALITY, std::getenv(LOSSLESS_ENV) != nullptr, 0, governor);
+    while (running_ && (subscribed_streams() & bit)) {
+        std::this_thread::sleep_until(stream.step());
+    }
+
+    streams_[streamId].active = false;
+}
+#endif
+
 void Network::stop()
 {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
     stopReceiving();
-    closesocket(socket_);
-    WSACleanup();
+    if (opened_) {
+        closesocket(socket_);
+        closesocket(control_);
+        socket_cleanup();
+        opened_ = false;
+    }
+}
+
+bool Network::sendFrame(const FrameBuffer& frame, uint64_t captureTime, uint8_t streamId)
+{
+    StageTimer timer(Stage::Send);
+
+    if (!remoteValid_ || streamId >= MAX_STREAMS) {
+        return false;
+    }
+
+    StreamState& stream = streams_[streamId];
+    uint64_t batchStart = 0;
+    size_t chunk = 0;
+
+    bool ok = Packetizer::packetize(frame.data(), frame.size(), stream.frameId, captureTime, streamId, sessionId_, stream.sequence,
+        [&](const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize) {
+            if (chunk % TRACE_SEND_BATCH == 0 && Trace::enabled()) {
+                batchStart = monotonic_us();
+            }
+
+            int sent = send_parts(socket_, header, headerSize, payload, payloadSize, remoteAddr_);
+
+            if (sent == SOCKET_ERROR) {
+                int err = WSAGetLastError();
+                std::cerr << "sendto failed, error: " << err << std::endl;
+                return false;
+            }
+
+            chunk++;
+            if (batchStart != 0 && (chunk % TRACE_SEND_BATCH == 0 || chunk * CHUNK_DATA_SIZE >= frame.size())) {
+                Trace::complete("send_batch", stream.frameId, batchStart, monotonic_us());
+                batchStart = 0;
+            }
+            return true;
+        });
+
+    stream.frameId++;
+    return ok;
 }
 
-bool Network::sendFrame(const std::vector<uint8_t>& frame)
+uint32_t Network::next_frame_id(uint8_t streamId) const
 {
-    sockaddr_in remoteAddr{};
-    remoteAddr.sin_family = AF_INET;
-    remoteAddr.sin_port = htons(port_recipient);
-    if (inet_pton(AF_INET, ip_recipient.c_str(), &remoteAddr.sin_addr) <= 0) {
+    return streams_[streamId].frameId;
+}
+
+uint32_t Network::session_id() const
+{
+    return sessionId_;
+}
+
+bool Network::sync_clock()
+{
+    if (!remoteValid_) {
         return false;
     }
 
-    static uint32_t frameId = 1;
-    size_t totalChunks = (frame.size() + CHUNK_DATA_SIZE - 1) / CHUNK_DATA_SIZE;
+    ClockSyncPacket request;
+    request.type = ClockMessage::Request;
+    request.t0 = monotonic_us();
+
+    uint8_t packet[ClockSyncPacket::SIZE];
+    request.write(packet);
 
-    for (size_t i = 0; i < totalChunks; i++) {
-        ChunkHeader header;
-        header.frameId = htonl(frameId);
-        header.chunkIndex = htons(static_cast<uint16_t>(i));
-        header.totalChunks = htons(static_cast<uint16_t>(totalChunks));
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(sizeof(packet)),
+        0,
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
 
-        size_t offset = i * CHUNK_DATA_SIZE;
-        size_t bytesLeft = frame.size() - offset;
-        size_t chunkSize = std::min(bytesLeft, CHUNK_DATA_SIZE);
+    return sent != SOCKET_ERROR;
+}
 
-        std::vector<uint8_t> packet(sizeof(header) + chunkSize);
-        std::memcpy(packet.data(), &header, sizeof(header));
-        std::memcpy(packet.data() + sizeof(header), frame.data() + offset, chunkSize);
+bool Network::send_event(EventType event, const EventPayload& evPayload)
+{
+    if (!remoteValid_) {
+        return false;
+    }
+
+    EventPacket message;
+    message.type = event;
+    message.payload = evPayload;
+
+    uint8_t packet[EventPacket::MAX_SIZE];
+    size_t size = message.write(packet);
+    if (size == 0) {
+        return false;
+    }
 
-        int sent = sendto(socket_,
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(size),
+        0,
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
+
+    return sent != SOCKET_ERROR;
+}
+
+bool Network::queue_event(EventType event, const EventPayload& payload)
+{
+    EventPacket message;
+    message.type = event;
+    message.payload = payload;
+
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    if (input_.add(message)) {
+        return true;
+    }
+    if (input_.empty()) {
+        return false;
+    }
+
+    // A full batch goes out early rather than holding events back for the next cycle.
+    bool sent = flushLocked();
+    return input_.add(message) && sent;
+}
+
+bool Network::flush_events()
+{
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    return input_.empty() || flushLocked();
+}
+
+bool Network::flushLocked()
+{
+    bool sent = false;
+    if (remoteValid_) {
+        sent = sendto(control_,
+            reinterpret_cast<const char*>(input_.data()),
+            static_cast<int>(input_.size()),
+            0,
+            reinterpret_cast<const sockaddr*>(&controlAddr_),
+            sizeof(controlAddr_)) != SOCKET_ERROR;
+    }
+    input_.clear();
+    return sent;
+}
+
+bool Network::request_tile_cache(uint8_t streamId)
+{
+    if (!remoteValid_) {
+        return false;
+    }
+
+    CacheAnnouncePacket request;
+    request.streamId = streamId;
+    uint8_t packet[CacheAnnouncePacket::HEADER_SIZE];
+    request.write(packet);
+
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(sizeof(packet)),
+        0,
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
+
+    return sent != SOCKET_ERROR;
+}
+
+bool Network::tile_cache_requested(uint8_t streamId)
+{
+    return streams_[streamId].cacheRequested.exchange(false);
+}
+
+bool Network::send_tile_cache(const std::vector<CacheEntry>& entries, uint8_t streamId)
+{
+    if (!remoteValid_) {
+        return false;
+    }
+
+    CacheAnnouncePacket announce;
+    announce.streamId = streamId;
+    announce.announceId = ++streams_[streamId].cacheAnnounceId;
+    announce.parts = static_cast<uint16_t>(std::max<size_t>(1,
+        (entries.size() + CacheAnnouncePacket::MAX_ENTRIES - 1) / CacheAnnouncePacket::MAX_ENTRIES));
+
+    std::vector<uint8_t> packet;
+    for (size_t i = 0; i < announce.parts; i++) {
+        size_t first = i * CacheAnnouncePacket::MAX_ENTRIES;
+        size_t last = std::min(entries.size(), first + CacheAnnouncePacket::MAX_ENTRIES);
+        announce.part = static_cast<uint16_t>(i);
+        announce.entries.assign(entries.begin() + first, entries.begin() + last);
+
+        packet.resize(announce.size());
+        announce.write(packet.data());
+
+        int sent = sendto(control_,
             reinterpret_cast<const char*>(packet.data()),
             static_cast<int>(packet.size()),
             0,
-            reinterpret_cast<sockaddr*>(&remoteAddr),
-            sizeof(remoteAddr));
+            reinterpret_cast<const sockaddr*>(&controlAddr_),
+            sizeof(controlAddr_));
 
         if (sent == SOCKET_ERROR) {
-            int err = WSAGetLastError();
-            std::cerr << "sendto failed, error: " << err << std::endl;
             return false;
         }
     }
-
-    frameId++;
     return true;
 }
 
-bool Network::send_event(EventType event, const EventPayload& evPayload)
+std::optional<std::vector<CacheEntry>> Network::take_tile_cache(uint8_t streamId)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    std::optional<std::vector<CacheEntry>> entries = std::move(streams_[streamId].announcedCache);
+    streams_[streamId].announcedCache.reset();
+    return entries;
+}
+
+bool Network::request_keyframe(uint32_t lastFrameId, uint8_t streamId)
 {
-    sockaddr_in remoteAddr{};
-    remoteAddr.sin_family = AF_INET;
-    remoteAddr.sin_port = htons(port_recipient);
-    if (inet_pton(AF_INET, ip_recipient.c_str(), &remoteAddr.sin_addr) <= 0) {
+    if (!remoteValid_) {
         return false;
     }
 
-    std::vector<uint8_t> packet;
-    packet.push_back(static_cast<uint8_t>(0xBB));
-    packet.push_back(static_cast<uint8_t>(event));
+    KeyframeRequestPacket request;
+    request.streamId = streamId;
+    request.frameId = lastFrameId;
 
-    std::vector<uint8_t> payload;
+    uint8_t packet[KeyframeRequestPacket::SIZE];
+    request.write(packet);
 
-    std::visit([&](auto&& arg) {
-        using T = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<T, MouseMoveData> || std::is_same_v<T, MouseClickData>) {
-            payload.push_back(static_cast<uint8_t>(arg.x & 0xFF));
-            payload.push_back(static_cast<uint8_t>((arg.x >> 8) & 0xFF));
-            payload.push_back(static_cast<uint8_t>(arg.y & 0xFF));
-            payload.push_back(static_cast<uint8_t>((arg.y >> 8) & 0xFF));
-        }
-        else if constexpr (std::is_same_v<T, MouseWheelData>) {
-            payload.push_back(static_cast<uint8_t>(arg.x & 0xFF));
-            payload.push_back(static_cast<uint8_t>((arg.x >> 8) & 0xFF));
-            payload.push_back(static_cast<uint8_t>(arg.y & 0xFF));
-            payload.push_back(static_cast<uint8_t>((arg.y >> 8) & 0xFF));
-            payload.push_back(static_cast<uint8_t>(arg.delta & 0xFF));
-            payload.push_back(static_cast<uint8_t>((arg.delta >> 8) & 0xFF));
-        }
-        else if constexpr (std::is_same_v<T, KeyPressData>) {
-            payload.push_back(static_cast<uint8_t>(arg.keycode & 0xFF));
-            payload.push_back(static_cast<uint8_t>((arg.keycode >> 8) & 0xFF));
-        }
-        }, evPayload);
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(sizeof(packet)),
+        0,
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
+
+    return sent != SOCKET_ERROR;
+}
+
+bool Network::keyframe_requested(uint8_t streamId)
+{
+    return streams_[streamId].keyframeRequested.exchange(false);
+}
+
+bool Network::ack_frame(uint32_t frameId, uint8_t streamId)
+{
+    if (!remoteValid_) {
+        return false;
+    }
+
+    FrameAckPacket ack;
+    ack.streamId = streamId;
+    ack.frameId = frameId;
+
+    uint8_t packet[FrameAckPacket::SIZE];
+    ack.write(packet);
+
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(sizeof(packet)),
+        0,
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
+
+    return sent != SOCKET_ERROR;
+}
+
+void Network::take_acks(std::vector<uint32_t>& acks, uint8_t streamId)
+{
+    acks.clear();
+    std::lock_guard<std::mutex> lock(ack_mutex_);
+    acks.swap(streams_[streamId].acks);
+}
+
+bool Network::subscribe(uint8_t streams)
+{
+    if (!remoteValid_) {
+        return false;
+    }
+
+    StreamListPacket request;
+    request.subscribed = streams;
+
+    uint8_t packet[StreamListPacket::HEADER_SIZE];
+    request.write(packet);
+
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(sizeof(packet)),
+        0,
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
+
+    return sent != SOCKET_ERROR;
+}
+
+uint8_t Network::subscribed_streams() const
+{
+    return subscribed_;
+}
+
+void Network::set_monitors(const std::vector<MonitorInfo>& monitors)
+{
+    std::lock_guard<std::mutex> lock(monitor_mutex_);
+    monitors_ = monitors;
+}
+
+MonitorInfo Network::monitor(uint8_t streamId) const
+{
+    std::lock_guard<std::mutex> lock(monitor_mutex_);
+    return streamId < monitors_.size() ? monitors_[streamId] : MonitorInfo{};
+}
+
+bool Network::send_viewport(const cv::Rect& area, uint8_t streamId)
+{
+    if (!remoteValid_) {
+        return false;
+    }
 
-    packet.push_back(static_cast<uint8_t>(payload.size()));
-    packet.insert(packet.end(), payload.begin(), payload.end());
+    ViewportPacket viewport;
+    viewport.streamId = streamId;
+    viewport.x = static_cast<uint16_t>(area.x);
+    viewport.y = static_cast<uint16_t>(area.y);
+    viewport.width = static_cast<uint16_t>(area.width);
+    viewport.height = static_cast<uint16_t>(area.height);
 
-    int sent = sendto(socket_,
-        reinterpret_cast<const char*>(packet.data()),
-        static_cast<int>(packet.size()),
+    uint8_t packet[ViewportPacket::SIZE];
+    viewport.write(packet);
+
+    int sent = sendto(control_,
+        reinterpret_cast<const char*>(packet),
+        static_cast<int>(sizeof(packet)),
         0,
-        reinterpret_cast<sockaddr*>(&remoteAddr),
-        sizeof(remoteAddr));
+        reinterpret_cast<const sockaddr*>(&controlAddr_),
+        sizeof(controlAddr_));
 
     return sent != SOCKET_ERROR;
 }
 
+std::optional<cv::Rect> Network::take_viewport(uint8_t streamId)
+{
+    std::lock_guard<std::mutex> lock(viewport_mutex_);
+    std::optional<cv::Rect> area = streams_[streamId].viewport;
+    streams_[streamId].viewport.reset();
+    return area;
+}
+
 void Network::startReceiving()
 {
     if (running_) return;
     running_ = true;
     recvThread_ = std::thread(&Network::receiveLoop, this);
+    controlThread_ = std::thread(&Network::controlLoop, this);
+    injectThread_ = std::thread(&Network::injectLoop, this);
 }
 
 void Network::stopReceiving()
@@ -186,16 +604,32 @@ void Network::stopReceiving()
         closesocket(socket_);
         socket_ = INVALID_SOCKET;
     }
+    if (control_ != INVALID_SOCKET) {
+        shutdown(control_, SD_BOTH);
+        closesocket(control_);
+        control_ = INVALID_SOCKET;
+    }
 
     if (recvThread_.joinable())
         recvThread_.join();
+    if (controlThread_.joinable())
+        controlThread_.join();
+
+    {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        inject_cv_.notify_one();
+    }
+    if (injectThread_.joinable())
+        injectThread_.join();
 }
 
 void Network::receiveLoop()
 {
+    Trace::name_thread("receive");
+
     std::vector<uint8_t> buffer(4 * 1024 * 1024);
     sockaddr_in senderAddr;
-    int senderAddrSize = sizeof(senderAddr);
+    socklen_type senderAddrSize = sizeof(senderAddr);
 
     while (running_) {
         int received = recvfrom(socket_,
@@ -205,28 +639,83 @@ void Network::receiveLoop()
             (sockaddr*)&senderAddr,
             &senderAddrSize);
 
+        // Only frame chunks travel on this socket; everything else arrives in controlLoop.
         if (received > 0) {
             uint8_t firstByte = buffer[0];
-            if (firstByte == 0xAA) {
-                if (received < sizeof(ChunkHeader)) {
+            if (firstByte == CHUNK_MAGIC) {
+                ChunkHeader header;
+                if (!header.read(buffer.data(), received)) {
                     continue;
                 }
 
-                ChunkHeader header;
-                std::memcpy(&header, buffer.data(), sizeof(header));
-
-                header.frameId = ntohl(header.frameId);
-                header.chunkIndex = ntohs(header.chunkIndex);
-                header.totalChunks = ntohs(header.totalChunks);
-
-                size_t dataSize = received - sizeof(header);
-                const uint8_t* dataPtr = buffer.data() + sizeof(header);
+                size_t dataSize = received - ChunkHeader::SIZE;
+                const uint8_t* dataPtr = buffer.data() + ChunkHeader::SIZE;
 
                 handleChunk(header, dataPtr, dataSize, senderAddr);
             }
-            else if (firstByte == 0xBB) {
+        }
+        else if (received == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err != WSAEWOULDBLOCK && running_) {
+                std::cerr << "recvfrom failed, error: " << err << std::endl;
+            }
+        }
+    }
+}
+
+void Network::controlLoop()
+{
+    Trace::name_thread("control");
+
+    std::vector<uint8_t> buffer(64 * 1024);
+    sockaddr_in senderAddr;
+    socklen_type senderAddrSize = sizeof(senderAddr);
+
+    while (running_) {
+        int received = recvfrom(control_,
+            reinterpret_cast<char*>(buffer.data()),
+            static_cast<int>(buffer.size()),
+            0,
+            (sockaddr*)&senderAddr,
+            &senderAddrSize);
+
+        if (received > 0) {
+            uint8_t firstByte = buffer[0];
+            if (firstByte == EVENT_MAGIC) {
                 handleEvent(buffer.data(), received, senderAddr);
             }
+            else if (firstByte == INPUT_MAGIC) {
+                handleInput(buffer.data(), received);
+            }
+            else if (firstByte == CLOCK_MAGIC) {
+                handleClock(buffer.data(), received, senderAddr, monotonic_us());
+            }
+            else if (firstByte == CACHE_MAGIC) {
+                handleCache(buffer.data(), received);
+            }
+            else if (firstByte == KEYFRAME_MAGIC) {
+                KeyframeRequestPacket request;
+                if (request.read(buffer.data(), received)) {
+                    streams_[request.streamId].keyframeRequested = true;
+                }
+            }
+            else if (firstByte == ACK_MAGIC) {
+                FrameAckPacket ack;
+                if (ack.read(buffer.data(), received)) {
+                    std::lock_guard<std::mutex> lock(ack_mutex_);
+                    streams_[ack.streamId].acks.push_back(ack.frameId);
+                }
+            }
+            else if (firstByte == STREAM_MAGIC) {
+                handleStreams(buffer.data(), received, senderAddr);
+            }
+            else if (firstByte == VIEWPORT_MAGIC) {
+                ViewportPacket viewport;
+                if (viewport.read(buffer.data(), received)) {
+                    std::lock_guard<std::mutex> lock(viewport_mutex_);
+                    streams_[viewport.streamId].viewport = cv::Rect(viewport.x, viewport.y, viewport.width, viewport.height);
+                }
+            }
         }
         else if (received == SOCKET_ERROR) {
             int err = WSAGetLastError();
@@ -241,94 +730,300 @@ void Network::handleChunk(const ChunkHeader& header,
     const uint8_t* data, size_t dataSize,
     const sockaddr_in& senderAddr)
 {
-    auto& frame = frames_progress_[header.frameId];
+    StageTimer timer(Stage::Chunk);
+
+    uint64_t now = monotonic_us();
+    PeerSession* session = findSession(SessionKey{ senderAddr.sin_addr.s_addr, senderAddr.sin_port, header.sessionId }, now);
+    if (!session) return;
+
+    counters_.chunksReceived++;
+    counters_.bytesReceived += ChunkHeader::SIZE + dataSize;
+    session->chunksReceived++;
+    session->bytesReceived += ChunkHeader::SIZE + dataSize;
+    PeerSession::Stream& stream = session->streams[header.streamId];
+    trackSequence(*session, stream, header.sequence);
+
+    uint64_t dropped = stream.assembler.dropped_frames();
+    auto fullFrame = stream.assembler.add_chunk(header, data, dataSize);
+    uint64_t incomplete = stream.assembler.dropped_frames() - dropped;
+    counters_.framesIncomplete += incomplete;
+    session->framesIncomplete += incomplete;
+    if (!fullFrame) return;
+    fullFrame->session = session->id;
+
+    if (clock_.synced()) {
+        uint64_t arrived = monotonic_us();
+        uint64_t captured = clock_.to_local(fullFrame->captureTime);
+        if (arrived > captured) {
+            Stats::record(Stage::OneWay, std::chrono::microseconds(arrived - captured));
+        }
+    }
+
+    pushFrame(std::move(*fullFrame));
+    counters_.framesReceived++;
+    session->framesReceived++;
+}
+
+// One lookup per chunk, and consecutive chunks nearly always share the sender, so the last
+// session is checked before the table. New senders are added up to MAX_SESSIONS. Sessions
+// behind one address and port (a NAT, a relay) stay apart by their session IDs, so a
+// restarted sender is not recognised as such; its old session just times out.
+PeerSession* Network::findSession(const SessionKey& key, uint64_t now)
+{
+    if (now - lastExpiry_ >= static_cast<uint64_t>(std::chrono::microseconds(SESSION_SWEEP_INTERVAL).count())) {
+        expireSessions(now);
+    }
+    if (lastSession_ && lastSession_->key == key) {
+        lastSession_->lastSeen.store(now, std::memory_order_relaxed);
+        return lastSession_;
+    }
+
+    auto it = sessions_.find(key);
+    if (it == sessions_.end()) {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        if (sessions_.size() >= MAX_SESSIONS) {
+            counters_.sessionsRejected++;
+            lastSession_ = nullptr;
+            return nullptr;
+        }
+
+        auto session = std::make_unique<PeerSession>();
+        session->id = nextSession_++;
+        session->key = key;
+        it = sessions_.emplace(key, std::move(session)).first;
+    }
+
+    lastSession_ = it->second.get();
+    lastSession_->lastSeen.store(now, std::memory_order_relaxed);
+    return lastSession_;
+}
+
+void Network::expireSessions(uint64_t now)
+{
+    lastExpiry_ = now;
+    const uint64_t timeout = std::chrono::microseconds(SESSION_TIMEOUT).count();
 
-    if (frame.totalChunks == 0) {
-        frame.totalChunks = header.totalChunks;
-        frame.chunks.resize(header.totalChunks);
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+        if (now - it->second->lastSeen.load(std::memory_order_relaxed) >= timeout) {
+            if (lastSession_ == it->second.get()) lastSession_ = nullptr;
+            it = sessions_.erase(it);
+        }
+        else {
+            ++it;
+        }
     }
+}
 
-    if (header.chunkIndex < frame.chunks.size() &&
-        frame.chunks[header.chunkIndex].empty()) {
-        frame.chunks[header.chunkIndex].assign(data, data + dataSize);
-        frame.receivedChunks++;
+// A chunk that arrives late is taken back off the loss count only if its sequence is one
+// of the last SEQUENCE_WINDOW and was counted missing; duplicates and older stragglers
+// change nothing.
+void Network::trackSequence(PeerSession& session, PeerSession::Stream& stream, uint32_t sequence)
+{
+    if (!stream.sequenceStarted) {
+        stream.sequenceStarted = true;
+        stream.expectedSequence = sequence + 1;
+        return;
     }
 
-    if (frame.receivedChunks == frame.totalChunks) {
-        std::vector<uint8_t> fullFrame;
-        for (auto& c : frame.chunks) {
-            fullFrame.insert(fullFrame.end(), c.begin(), c.end());
+    int32_t gap = static_cast<int32_t>(sequence - stream.expectedSequence);
+    if (gap >= 0) {
+        counters_.chunksLost += static_cast<uint32_t>(gap);
+        session.chunksLost += static_cast<uint32_t>(gap);
+        stream.expectedSequence = sequence + 1;
+
+        // The skipped sequences take over their slots from ones that leave the window.
+        uint32_t skipped = std::min<uint32_t>(static_cast<uint32_t>(gap), SEQUENCE_WINDOW - 1);
+        for (uint32_t s = sequence - skipped; s != sequence; s++) {
+            stream.missed.set(s % SEQUENCE_WINDOW);
         }
+        stream.missed.reset(sequence % SEQUENCE_WINDOW);
+        return;
+    }
 
-        pushFrame(std::move(fullFrame));
-        frames_progress_.erase(header.frameId);
+    uint32_t age = stream.expectedSequence - 1 - sequence;
+    if (age < SEQUENCE_WINDOW && stream.missed.test(sequence % SEQUENCE_WINDOW)) {
+        stream.missed.reset(sequence % SEQUENCE_WINDOW);
+        counters_.chunksLost--;
+        session.chunksLost--;
     }
 }
 
 void Network::handleEvent(const uint8_t* data, size_t size, const sockaddr_in& senderAddr)
 {
-    if (size < 2) return;
+    EventPacket packet;
+    if (packet.read(data, size)) {
+        counters_.inputPackets++;
+        counters_.inputEvents++;
+        enqueueInput(packet);
+    }
+}
 
-    EventType event = static_cast<EventType>(data[1]);
-    uint8_t payloadSize = data[2];
+void Network::handleInput(const uint8_t* data, size_t size)
+{
+    counters_.inputPackets++;
+    InputBatchPacket::read(data, size, [&](const EventPacket& event) {
+        counters_.inputEvents++;
+        enqueueInput(event);
+    });
+}
+
+// Injection can block for a while (SendInput waits on the desktop), so it runs on its own
+// thread behind a lock-free queue: the receive thread never waits for it, and a burst of
+// frame chunks never holds a click back.
+void Network::enqueueInput(const EventPacket& event)
+{
+    if (!input_queue_.push(QueuedInput{ event, monotonic_us() })) {
+        counters_.inputDropped++;
+        return;
+    }
 
-    if (size < 2 + payloadSize) return;
+    // Pairs with the fence in injectLoop: either it sees the event or we see it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (injectWaiting_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        inject_cv_.notify_one();
+    }
+}
+
+void Network::injectLoop()
+{
+    Trace::name_thread("inject");
+
+    QueuedInput input;
+    while (running_) {
+        if (!input_queue_.pop(input)) {
+            std::unique_lock<std::mutex> lock(inject_mutex_);
+            injectWaiting_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            inject_cv_.wait_for(lock, INJECT_IDLE_WAIT, [&] { return !input_queue_.empty() || !running_; });
+            injectWaiting_.store(false, std::memory_order_relaxed);
+            continue;
+        }
 
-    EventPayload payload;
+        // A move with another move already queued behind it would be overwritten at once.
+        if (input.event.type == EventType::MouseMove) {
+            const QueuedInput* next = input_queue_.peek();
+            if (next && next->event.type == EventType::MouseMove) {
+                counters_.inputMerged++;
+                continue;
+            }
+        }
 
-    switch (event) {
-    case EventType::MouseMove: {
-        if (payloadSize != 4) break;
-        int x = data[3] | (data[4] << 8);
-        int y = data[5] | (data[6] << 8);
-        payload = MouseMoveData{ x, y };
-        commitEvent(event, payload);
-        break;
+        {
+            StageTimer timer(Stage::Inject);
+            if (injector_) {
+                injector_(input.event.type, input.event.payload);
+            }
+            else {
+                commitEvent(input.event.type, input.event.payload);
+            }
+        }
+        Stats::record(Stage::InputDelay, std::chrono::microseconds(monotonic_us() - input.receivedAt));
     }
+}
+
+void Network::set_input_injector(InputInjector injector)
+{
+    injector_ = std::move(injector);
+}
+
+void Network::handleClock(const uint8_t* data, size_t size, const sockaddr_in& senderAddr, uint64_t receivedAt)
+{
+    ClockSyncPacket packet;
+    if (!packet.read(data, size)) return;
 
-    case EventType::MouseLeftClick: {
-        if (payloadSize != 4) break;
-        int x = data[3] | (data[4] << 8);
-        int y = data[5] | (data[6] << 8);
-        payload = MouseClickData{ x, y };
-        commitEvent(event, payload);
-        break;
+    if (packet.type == ClockMessage::Request) {
+        ClockSyncPacket reply;
+        reply.type = ClockMessage::Reply;
+        reply.t0 = packet.t0;
+        reply.t1 = receivedAt;
+        reply.t2 = monotonic_us();
+
+        uint8_t out[ClockSyncPacket::SIZE];
+        reply.write(out);
+
+        sendto(control_,
+            reinterpret_cast<const char*>(out),
+            static_cast<int>(sizeof(out)),
+            0,
+            reinterpret_cast<const sockaddr*>(&senderAddr),
+            sizeof(senderAddr));
     }
+    else if (packet.type == ClockMessage::Reply) {
+        clock_.add_sample(packet.t0, packet.t1, packet.t2, receivedAt);
+        if (receivedAt >= packet.t0 && packet.t2 >= packet.t1) {
+            uint64_t rtt = (receivedAt - packet.t0) - std::min(receivedAt - packet.t0, packet.t2 - packet.t1);
+            Stats::record(Stage::ControlRtt, std::chrono::microseconds(rtt));
+        }
+    }
+}
 
-    case EventType::MouseRightClick: {
-        if (payloadSize != 4) break;
-        int x = data[3] | (data[4] << 8);
-        int y = data[5] | (data[6] << 8);
-        payload = MouseClickData{ x, y };
-        commitEvent(event, payload);
-        break;
+void Network::handleCache(const uint8_t* data, size_t size)
+{
+    CacheAnnouncePacket packet;
+    if (!packet.read(data, size)) return;
+
+    StreamState& stream = streams_[packet.streamId];
+    if (packet.parts == 0) {
+        stream.cacheRequested = true;
+        return;
     }
+    if (packet.part >= packet.parts) return;
 
-    case EventType::MouseWheel: {
-        if (payloadSize != 6) break;
-        int x = data[3] | (data[4] << 8);
-        int y = data[5] | (data[6] << 8);
-        int delta = data[6] | (data[7] << 8);
-        payload = MouseWheelData{ x, y, delta };
-        commitEvent(event, payload);
-        break;
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (packet.announceId != stream.incomingAnnounceId || packet.parts != stream.incomingParts) {
+        stream.incomingAnnounceId = packet.announceId;
+        stream.incomingParts = packet.parts;
+        stream.incomingCache.assign(packet.parts, {});
+        stream.incomingSeen.assign(packet.parts, false);
     }
 
-    case EventType::KeyPress: {
-        if (payloadSize != 2) break;
-        int keycode = data[3] | (data[4] << 8);
-        payload = KeyPressData{ keycode };
-        commitEvent(event, payload);
-        break;
+    stream.incomingCache[packet.part] = std::move(packet.entries);
+    stream.incomingSeen[packet.part] = true;
+    if (std::find(stream.incomingSeen.begin(), stream.incomingSeen.end(), false) != stream.incomingSeen.end()) return;
+
+    std::vector<CacheEntry> entries;
+    for (auto& part : stream.incomingCache) {
+        entries.insert(entries.end(), part.begin(), part.end());
     }
+    stream.announcedCache = std::move(entries);
+    stream.incomingParts = 0;
+}
+
+void Network::handleStreams(const uint8_t* data, size_t size, const sockaddr_in& senderAddr)
+{
+    StreamListPacket packet;
+    if (!packet.read(data, size)) return;
+
+    if (packet.type == StreamMessage::Subscribe) {
+        subscribed_ = packet.subscribed;
+
+        StreamListPacket reply;
+        reply.type = StreamMessage::Layout;
+        reply.subscribed = packet.subscribed;
+        {
+            std::lock_guard<std::mutex> lock(monitor_mutex_);
+            reply.monitors = monitors_;
+        }
 
-    default:
-        break;
+        std::vector<uint8_t> out(reply.size());
+        reply.write(out.data());
+        sendto(control_,
+            reinterpret_cast<const char*>(out.data()),
+            static_cast<int>(out.size()),
+            0,
+            reinterpret_cast<const sockaddr*>(&senderAddr),
+            sizeof(senderAddr));
+    }
+    else if (packet.type == StreamMessage::Layout) {
+        set_monitors(packet.monitors);
     }
 }
 
 void Network::commitEvent(EventType event, const EventPayload& payload)
 {
+#ifdef _WIN32
     std::visit([&](auto&& arg) {
         using T = std::decay_t<decltype(arg)>;
         if constexpr (std::is_same_v<T, MouseMoveData>) {
@@ -366,22 +1061,175 @@ void Network::commitEvent(EventType event, const EventPayload& payload)
             return;
         }
         }, payload);
+#else
+    (void)event;
+    (void)payload;
+#endif
 }
 
-void Network::pushFrame(std::vector<uint8_t>&& frame)
+void Network::pushFrame(ReceivedFrame&& frame)
 {
-    // std::lock_guard<std::mutex> lock(frame_mutex_);
-    frame_queue_.push(std::move(frame));
-    if (frame_queue_.size() > 5) {
-        frame_queue_.pop();
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    const uint8_t streamId = frame.streamId;
+    const uint32_t session = frame.session;
+    frame_queue_.push_back(std::move(frame));
+
+    // The depth limit is per stream of each sender: a busy monitor drops its own oldest frame, not another's.
+    auto same = [&](const ReceivedFrame& queued) { return queued.streamId == streamId && queued.session == session; };
+    if (static_cast<size_t>(std::count_if(frame_queue_.begin(), frame_queue_.end(), same)) > FRAME_QUEUE_DEPTH) {
+        frame_queue_.erase(std::find_if(frame_queue_.begin(), frame_queue_.end(), same));
     }
+    counters_.queueDepth = frame_queue_.size();
 }
 
-std::optional<std::vector<uint8_t>> Network::get_frame()
+std::optional<ReceivedFrame> Network::get_frame()
 {
-    // std::lock_guard<std::mutex> lock(frame_mutex_);
+    StageTimer timer(Stage::GetFrame);
+
+    std::lock_guard<std::mutex> lock(frame_mutex_);
     if (frame_queue_.empty()) return std::nullopt;
     auto f = std::move(frame_queue_.front());
-    frame_queue_.pop();
+    frame_queue_.erase(frame_queue_.begin());
+    counters_.queueDepth = frame_queue_.size();
     return f;
+}
+
+void Network::frame_presented(const ReceivedFrame& frame)
+{
+    counters_.framesDisplayed++;
+    if (!clock_.synced()) return;
+
+    uint64_t presented = monotonic_us();
+    uint64_t captured = clock_.to_local(frame.captureTime);
+    if (presented > captured) {
+        Stats::record(Stage::CaptureToPresent, std::chrono::microseconds(presented - captured));
+        counters_.latencyUs = static_cast<int64_t>(presented - captured);
+    }
+}
+
+NetworkStats Network::stats() const
+{
+    NetworkStats s;
+    s.framesReceived = counters_.framesReceived;
+    s.framesDisplayed = counters_.framesDisplayed;
+    s.framesIncomplete = counters_.framesIncomplete;
+    s.bytesReceived = counters_.bytesReceived;
+    s.chunksReceived = counters_.chunksReceived;
+    s.chunksLost = counters_.chunksLost;
+    s.queueDepth = counters_.queueDepth;
+    s.inputPackets = counters_.inputPackets;
+    s.inputEvents = counters_.inputEvents;
+    s.inputMerged = counters_.inputMerged;
+    s.inputDropped = counters_.inputDropped;
+    s.sessionsRejected = counters_.sessionsRejected;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        s.sessions = sessions_.size();
+    }
+    s.latencyUs = counters_.latencyUs;
+    s.rttUs = clock_.synced() ? clock_.rtt_us() : -1;
+    return s;
+}
+
+std::vector<SessionStats> Network::sessions() const
+{
+    std::vector<SessionStats> result;
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (const auto& entry : sessions_) {
+        const PeerSession& session = *entry.second;
+        SessionStats s;
+        s.id = session.id;
+        char address[INET_ADDRSTRLEN] = {};
+        in_addr raw{};
+        raw.s_addr = session.key.address;
+        inet_ntop(AF_INET, &raw, address, sizeof(address));
+        s.address = address;
+        s.port = ntohs(session.key.port);
+        s.sessionId = session.key.sessionId;
+        s.framesReceived = session.framesReceived;
+        s.framesIncomplete = session.framesIncomplete;
+        s.bytesReceived = session.bytesReceived;
+        s.chunksReceived = session.chunksReceived;
+        s.chunksLost = session.chunksLost;
+        result.push_back(s);
+    }
+    std::sort(result.begin(), result.end(), [](const SessionStats& a, const SessionStats& b) { return a.id < b.id; });
+    return result;
+}
+
+bool Network::session_active(uint32_t session) const
+{
+    const uint64_t idle = std::chrono::microseconds(SESSION_IDLE_TIMEOUT).count();
+    const uint64_t now = monotonic_us();
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (const auto& entry : sessions_) {
+        if (entry.second->id == session) {
+            uint64_t lastSeen = entry.second->lastSeen.load(std::memory_order_relaxed);
+            return lastSeen > now || now - lastSeen < idle;
+        }
+    }
+    return false;
+}
+
+uint8_t parse_stream_mask(const char* value)
+{
+    if (!value || !*value) return 1;
+    if (std::string(value) == "all") return 0xFF;
+
+    uint8_t mask = 0;
+    for (const char* p = value; *p; ) {
+        char* end = nullptr;
+        long index = std::strtol(p, &end, 10);
+        if (end == p) {
+            p++;
+            continue;
+        }
+        if (index >= 0 && index < static_cast<long>(MAX_STREAMS)) {
+            mask |= static_cast<uint8_t>(1u << index);
+        }
+        p = end;
+    }
+    return mask != 0 ? mask : 1;
+}
+
+
+// ClockEstimator
+
+void ClockEstimator::add_sample(uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3)
+{
+    int64_t rtt = static_cast<int64_t>(t3 - t0) - static_cast<int64_t>(t2 - t1);
+    if (rtt < 0) return;
+
+    int64_t offset = (static_cast<int64_t>(t1 - t0) + static_cast<int64_t>(t2 - t3)) / 2;
+    samples_[count_ % WINDOW] = { offset, rtt };
+    count_++;
+
+    const Sample* best = &samples_[0];
+    for (size_t i = 1; i < std::min(count_, WINDOW); i++) {
+        if (samples_[i].rtt < best->rtt) best = &samples_[i];
+    }
+
+    offset_ = best->offset;
+    rtt_ = best->rtt;
+    synced_ = true;
+}
+
+bool ClockEstimator::synced() const
+{
+    return synced_;
+}
+
+int64_t ClockEstimator::offset_us() const
+{
+    return offset_;
+}
+
+int64_t ClockEstimator::rtt_us() const
+{
+    return rtt_;
+}
+
+uint64_t ClockEstimator::to_local(uint64_t remoteTime) const
+{
+    return static_cast<uint64_t>(static_cast<int64_t>(remoteTime) - offset_.load());
 }
\ No newline at end of file
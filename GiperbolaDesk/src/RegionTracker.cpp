@@ -0,0 +1,127 @@
+#include "../include/RegionTracker.hpp"
+#include <algorithm>
+
+
+static int bit_count(uint16_t value)
+{
+    int count = 0;
+    for (; value; value &= value - 1) {
+        count++;
+    }
+    return count;
+}
+
+const std::vector<cv::Rect>& RegionTracker::update(const std::vector<uint8_t>& changed, const cv::Size& frameSize)
+{
+    const int cols = (frameSize.width + CHANGED_BLOCK - 1) / CHANGED_BLOCK;
+    const int rows = (frameSize.height + CHANGED_BLOCK - 1) / CHANGED_BLOCK;
+    if (cols != cols_ || rows != rows_ || changed.size() != history_.size()) {
+        cols_ = cols;
+        rows_ = rows;
+        history_.assign(static_cast<size_t>(cols) * rows, 0);
+        regions_.clear();
+        if (changed.size() != history_.size()) return regions_;
+    }
+
+    std::vector<uint8_t> hot(history_.size(), 0);
+    for (int row = 0; row < rows_; row++) {
+        for (int col = 0; col < cols_; col++) {
+            size_t i = static_cast<size_t>(row) * cols_ + col;
+            history_[i] = static_cast<uint16_t>((history_[i] << 1) | (changed[i] ? 1 : 0));
+            hot[i] = bit_count(history_[i]) >= VIDEO_ENTER_CHANGES ||
+                ((history_[i] & VIDEO_STAY_MASK) != 0 && inRegion(col, row));
+        }
+    }
+
+    findRegions(hot, frameSize);
+    return regions_;
+}
+
+const std::vector<cv::Rect>& RegionTracker::regions() const
+{
+    return regions_;
+}
+
+void RegionTracker::reset()
+{
+    std::fill(history_.begin(), history_.end(), 0);
+    regions_.clear();
+}
+
+bool RegionTracker::inRegion(int col, int row) const
+{
+    cv::Point origin(col * CHANGED_BLOCK, row * CHANGED_BLOCK);
+    for (auto& region : regions_) {
+        if (region.contains(origin)) return true;
+    }
+    return false;
+}
+
+void RegionTracker::findRegions(const std::vector<uint8_t>& hot, const cv::Size& frameSize)
+{
+    struct Box
+    {
+        cv::Rect cells;
+        int blocks;
+    };
+
+    std::vector<Box> boxes;
+    std::vector<uint8_t> seen(hot.size(), 0);
+    std::vector<int> stack;
+    for (size_t start = 0; start < hot.size(); start++) {
+        if (!hot[start] || seen[start]) continue;
+
+        int left = cols_, top = rows_, right = -1, bottom = -1, blocks = 0;
+        seen[start] = 1;
+        stack.assign(1, static_cast<int>(start));
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            int col = i % cols_, row = i / cols_;
+            left = std::min(left, col);
+            right = std::max(right, col);
+            top = std::min(top, row);
+            bottom = std::max(bottom, row);
+            blocks++;
+
+            const int next[] = { col > 0 ? i - 1 : -1, col + 1 < cols_ ? i + 1 : -1,
+                row > 0 ? i - cols_ : -1, row + 1 < rows_ ? i + cols_ : -1 };
+            for (int n : next) {
+                if (n >= 0 && hot[n] && !seen[n]) {
+                    seen[n] = 1;
+                    stack.push_back(n);
+                }
+            }
+        }
+
+        if (blocks >= VIDEO_MIN_BLOCKS) {
+            boxes.push_back(Box{ cv::Rect(left, top, right - left + 1, bottom - top + 1), blocks });
+        }
+    }
+
+    // Bounding boxes of separate components can still overlap; one region must own each block.
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (size_t a = 0; a < boxes.size() && !merged; a++) {
+            for (size_t b = a + 1; b < boxes.size(); b++) {
+                if ((boxes[a].cells & boxes[b].cells).empty()) continue;
+
+                boxes[a].cells = boxes[a].cells | boxes[b].cells;
+                boxes[a].blocks += boxes[b].blocks;
+                boxes.erase(boxes.begin() + b);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    std::sort(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) { return a.cells.area() > b.cells.area(); });
+    if (boxes.size() > VIDEO_MAX_REGIONS) boxes.resize(VIDEO_MAX_REGIONS);
+
+    const cv::Rect screen(0, 0, frameSize.width, frameSize.height);
+    regions_.clear();
+    for (auto& box : boxes) {
+        regions_.push_back(cv::Rect(box.cells.x * CHANGED_BLOCK, box.cells.y * CHANGED_BLOCK,
+            box.cells.width * CHANGED_BLOCK, box.cells.height * CHANGED_BLOCK) & screen);
+    }
+}
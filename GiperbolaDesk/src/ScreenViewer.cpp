@@ -1,12 +1,29 @@
 #include "../include/ScreenViewer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
 
 
-ScreenViewer::ScreenViewer()
+ScreenViewer::ScreenViewer(uint8_t streamId)
+    : stream_(streamId)
 {
     sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
-    window_.create(desktop, "GiperbolaDesk", sf::Style::Default);
-    window_.setPosition({ 0, 0 });
+    std::string title = streamId == 0 ? "GiperbolaDesk" : "GiperbolaDesk - monitor " + std::to_string(streamId);
+    window_.create(desktop, title, sf::Style::Default);
+    window_.setPosition({ 32 * streamId, 32 * streamId });
     window_.setFramerateLimit(60);
+    update_view();
+
+    font_.loadFromFile(std::filesystem::current_path().string() + "\\Graphics\\Fonts\\Inter\\Inter-Regular.otf");
+    overlay_text_.setFont(font_);
+    overlay_text_.setCharacterSize(14);
+    overlay_text_.setFillColor(sf::Color::White);
+    overlay_text_.setPosition(sf::Vector2f(18.f, 14.f));
+    overlay_bg_.setFillColor(sf::Color(0, 0, 0, 170));
+    overlay_bg_.setPosition(sf::Vector2f(8.f, 8.f));
+    overlay_updated_ = std::chrono::steady_clock::now();
 }
 
 bool ScreenViewer::is_open() const
@@ -23,52 +40,81 @@ bool ScreenViewer::poll_events(Network* network_)
             return false;
         }
 
+        if (event.type == sf::Event::Resized) {
+            update_view();
+            continue;
+        }
+
+        //     Ctrl +     ,   
+        if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Middle) {
+            drag_ = sf::Vector2i(event.mouseButton.x, event.mouseButton.y);
+            continue;
+        }
+        if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Middle) {
+            drag_.reset();
+            continue;
+        }
+        if (event.type == sf::Event::MouseMoved && drag_) {
+            pan(drag_->x - event.mouseMove.x, drag_->y - event.mouseMove.y, network_);
+            drag_ = sf::Vector2i(event.mouseMove.x, event.mouseMove.y);
+            continue;
+        }
+        if (event.type == sf::Event::MouseWheelScrolled &&
+            (sf::Keyboard::isKeyPressed(sf::Keyboard::LControl) || sf::Keyboard::isKeyPressed(sf::Keyboard::RControl))) {
+            zoom_at(event.mouseWheelScroll.x, event.mouseWheelScroll.y,
+                event.mouseWheelScroll.delta > 0 ? ZOOM_STEP : 1.f / ZOOM_STEP, network_);
+            continue;
+        }
+
         //  
         if (event.type == sf::Event::MouseMoved) {
-            int x = event.mouseMove.x;
-            int y = event.mouseMove.y;
+            sf::Vector2i at = to_host(event.mouseMove.x, event.mouseMove.y, network_);
+            int x = at.x;
+            int y = at.y;
 
             if (network_) {
-                static auto last_send = std::chrono::steady_clock::now();
-                auto now = std::chrono::steady_clock::now();
-                if (std::chrono::duration_cast<std::chrono::milliseconds>(now - last_send).count() > 1000) {
-                    network_->send_event(EventType::MouseMove, MouseMoveData{ x, y });
-                    last_send = now;
-                }
+                network_->queue_event(EventType::MouseMove, MouseMoveData{ x, y });
             }
         }
 
         //  
         if (event.type == sf::Event::MouseButtonPressed) {
-            int x = event.mouseButton.x;
-            int y = event.mouseButton.y;
+            sf::Vector2i at = to_host(event.mouseButton.x, event.mouseButton.y, network_);
+            int x = at.x;
+            int y = at.y;
 
             if (network_) {
                 if (event.mouseButton.button == sf::Mouse::Left) {
-                    network_->send_event(EventType::MouseLeftClick, MouseClickData{ x, y });
+                    network_->queue_event(EventType::MouseLeftClick, MouseClickData{ x, y });
                 }
                 else if (event.mouseButton.button == sf::Mouse::Right) {
-                    network_->send_event(EventType::MouseRightClick, MouseClickData{ x, y });
+                    network_->queue_event(EventType::MouseRightClick, MouseClickData{ x, y });
                 }
             }
         }
 
         //  
         if (event.type == sf::Event::MouseWheelScrolled) {
-            int x = static_cast<int>(event.mouseWheelScroll.x);
-            int y = static_cast<int>(event.mouseWheelScroll.y);
+            sf::Vector2i at = to_host(event.mouseWheelScroll.x, event.mouseWheelScroll.y, network_);
+            int x = at.x;
+            int y = at.y;
             int delta = static_cast<int>(event.mouseWheelScroll.delta);
 
             if (network_) {
-                network_->send_event(EventType::MouseWheel, MouseWheelData{ x, y, delta });
+                network_->queue_event(EventType::MouseWheel, MouseWheelData{ x, y, delta });
             }
         }
 
         //  
+        if (event.type == sf::Event::KeyPressed && event.key.code == OVERLAY_KEY) {
+            overlay_visible_ = !overlay_visible_;
+            continue;
+        }
+
         if (event.type == sf::Event::KeyPressed) {
             int keycode = static_cast<int>(event.key.code);
             if (network_) {
-                network_->send_event(EventType::KeyPress, KeyPressData{ keycode });
+                network_->queue_event(EventType::KeyPress, KeyPressData{ keycode });
             }
         }
     }
@@ -76,12 +122,170 @@ bool ScreenViewer::poll_events(Network* network_)
     return true;
 }
 
-void ScreenViewer::display_frame(const std::optional<std::vector<uint8_t>>& frame)
+bool ScreenViewer::display_frame(const ReceivedFrame& frame, Network* network_)
 {
-    texture_.loadFromMemory(frame->data(), frame->size());
-    sprite_.setTexture(texture_, true);
+    {
+        auto start = std::chrono::steady_clock::now();
+        StageTimer timer(Stage::Decode);
+        TraceSpan span("decode", frame.frameId);
+        if (!decoder_.apply(frame.data.data(), frame.data.size(), frame.frameId)) {
+            return false;
+        }
+
+        // A host short of CPU changes the frame size; the zoomed view stays on the same spot
+        // and the host learns the viewport in the new frame's pixels.
+        int width = decoder_.width(), height = decoder_.height();
+        sf::Vector2u previous = texture_.getSize();
+        if (previous.x != static_cast<unsigned>(width) || previous.y != static_cast<unsigned>(height)) {
+            if (previous.x > 0 && previous.y > 0) {
+                center_.x = center_.x * width / previous.x;
+                center_.y = center_.y * height / previous.y;
+            }
+            texture_.create(width, height);
+            sprite_.setTexture(texture_, true);
+            update_view();
+            if (network_) network_->send_viewport(viewport(), stream_);
+        }
+        texture_.update(decoder_.pixels().data());
+        decode_time_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    }
 
+    StageTimer timer(Stage::Present);
+    TraceSpan span("present", frame.frameId);
     window_.clear();
+    window_.setView(view_);
     window_.draw(sprite_);
+    window_.setView(window_.getDefaultView());
+    if (overlay_visible_) {
+        draw_overlay();
+    }
     window_.display();
-}
\ No newline at end of file
+    return true;
+}
+
+bool ScreenViewer::attach_tile_store(const std::string& path)
+{
+    return decoder_.attach_store(path);
+}
+
+std::vector<CacheEntry> ScreenViewer::cached_tiles() const
+{
+    return decoder_.cached_tiles();
+}
+
+uint64_t ScreenViewer::missing_tiles() const
+{
+    return decoder_.cache_stats().missing;
+}
+
+// Empty until the first frame, which the host reads as "everything".
+cv::Rect ScreenViewer::viewport() const
+{
+    sf::Vector2f size = view_.getSize();
+    sf::Vector2f center = view_.getCenter();
+    cv::Rect visible(static_cast<int>(std::floor(center.x - size.x / 2)), static_cast<int>(std::floor(center.y - size.y / 2)),
+        static_cast<int>(std::ceil(size.x)) + 1, static_cast<int>(std::ceil(size.y)) + 1);
+    return visible & cv::Rect(0, 0, decoder_.width(), decoder_.height());
+}
+
+void ScreenViewer::update_overlay(const NetworkStats& stats)
+{
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - overlay_updated_).count();
+    if (seconds < 0.5) return;
+
+    if (overlay_visible_) {
+        uint64_t chunks = stats.chunksReceived - overlay_prev_.chunksReceived;
+        uint64_t lost = stats.chunksLost - overlay_prev_.chunksLost;
+        double loss = chunks + lost > 0 ? 100.0 * lost / (chunks + lost) : 0.0;
+
+        const TileCacheStats& tiles = decoder_.cache_stats();
+        uint64_t lookups = tiles.hits + tiles.misses;
+        double hit_rate = lookups > 0 ? 100.0 * tiles.hits / lookups : 0.0;
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1)
+            << "Received:   " << (stats.framesReceived - overlay_prev_.framesReceived) / seconds << " fps\n"
+            << "Displayed:  " << (stats.framesDisplayed - overlay_prev_.framesDisplayed) / seconds << " fps\n"
+            << "Bitrate:    " << (stats.bytesReceived - overlay_prev_.bytesReceived) * 8.0 / seconds / 1e6 << " Mbit/s\n"
+            << "Chunk loss: " << std::setprecision(2) << loss << " %\n"
+            << "Incomplete: " << stats.framesIncomplete - overlay_prev_.framesIncomplete << " frames\n"
+            << std::setprecision(1)
+            << "Decode:     " << decode_time_.count() / 1000.0 << " ms\n"
+            << "Tile cache: " << hit_rate << " % hit, " << tiles.bytesSaved / 1e6 << " MB saved\n"
+            << "Queue:      " << stats.queueDepth << "\n"
+            << "Latency:    ";
+        if (stats.latencyUs >= 0) out << stats.latencyUs / 1000.0 << " ms";
+        else out << "n/a";
+        out << "\nRTT:        ";
+        if (stats.rttUs >= 0) out << stats.rttUs / 1000.0 << " ms";
+        else out << "n/a";
+
+        overlay_text_.setString(out.str());
+        sf::FloatRect bounds = overlay_text_.getLocalBounds();
+        overlay_bg_.setSize(sf::Vector2f(bounds.width + 24.f, bounds.height + 24.f));
+    }
+
+    overlay_prev_ = stats;
+    overlay_updated_ = now;
+}
+
+// Window coordinates go through the zoomed view to frame pixels, which are relative to the
+// monitor this window shows; the host wants virtual-screen ones. A host short of CPU may
+// send frames smaller than the monitor, so frame pixels are scaled to the monitor's size.
+sf::Vector2i ScreenViewer::to_host(int x, int y, const Network* network_) const
+{
+    sf::Vector2f at = window_.mapPixelToCoords(sf::Vector2i(x, y), view_);
+    sf::Vector2i pixel(static_cast<int>(at.x), static_cast<int>(at.y));
+    if (!network_) return pixel;
+    MonitorInfo monitor = network_->monitor(stream_);
+    if (monitor.width > 0 && decoder_.width() > 0 && static_cast<int>(monitor.width) != decoder_.width()) {
+        pixel.x = pixel.x * monitor.width / decoder_.width();
+        pixel.y = pixel.y * monitor.height / decoder_.height();
+    }
+    return { pixel.x + monitor.x, pixel.y + monitor.y };
+}
+
+// Keeps the frame point under the cursor in place.
+void ScreenViewer::zoom_at(int x, int y, float factor, Network* network_)
+{
+    sf::Vector2f before = window_.mapPixelToCoords(sf::Vector2i(x, y), view_);
+    zoom_ = std::clamp(zoom_ * factor, 1.f, MAX_ZOOM);
+    update_view();
+    sf::Vector2f after = window_.mapPixelToCoords(sf::Vector2i(x, y), view_);
+    center_.x += before.x - after.x;
+    center_.y += before.y - after.y;
+    update_view();
+
+    if (network_) network_->send_viewport(viewport(), stream_);
+}
+
+void ScreenViewer::pan(int dx, int dy, Network* network_)
+{
+    center_.x += dx / zoom_;
+    center_.y += dy / zoom_;
+    update_view();
+
+    if (network_) network_->send_viewport(viewport(), stream_);
+}
+
+// Along an axis where the frame is larger than the view the view stays on the frame;
+// where it is smaller the frame sits at the top left, as without zoom.
+void ScreenViewer::update_view()
+{
+    sf::Vector2u window = window_.getSize();
+    sf::Vector2f size(window.x / zoom_, window.y / zoom_);
+    float width = static_cast<float>(decoder_.width());
+    float height = static_cast<float>(decoder_.height());
+
+    center_.x = size.x < width ? std::clamp(center_.x, size.x / 2, width - size.x / 2) : size.x / 2;
+    center_.y = size.y < height ? std::clamp(center_.y, size.y / 2, height - size.y / 2) : size.y / 2;
+    view_.setSize(size);
+    view_.setCenter(center_);
+}
+
+void ScreenViewer::draw_overlay()
+{
+    window_.draw(overlay_bg_);
+    window_.draw(overlay_text_);
+}
@@ -0,0 +1,154 @@
+#include "../include/ScrollDetector.hpp"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+
+static constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+static constexpr uint64_t HASH_PRIME = 0x9e3779b97f4a7c15ull;
+
+static uint64_t hash_bytes(const uint8_t* data, size_t size)
+{
+    uint64_t h = HASH_SEED;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ word) * HASH_PRIME;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++) {
+        h = (h ^ data[i]) * HASH_PRIME;
+    }
+    return h;
+}
+
+std::optional<ScrollMatch> ScrollDetector::detect(const cv::Mat& previous, const cv::Mat& current)
+{
+    if (previous.size() != current.size() || previous.type() != CV_8UC3 || current.type() != CV_8UC3) {
+        return std::nullopt;
+    }
+
+    cv::Rect area = changed_area(previous, current);
+    if (area.width < SCROLL_MIN_LINES || area.height < SCROLL_MIN_LINES) {
+        return std::nullopt;
+    }
+
+    std::vector<uint64_t> before, after;
+    std::optional<ScrollMatch> best;
+    int bestPixels = 0;
+    int shift, start, length;
+
+    hashRows(previous, area, before);
+    hashRows(current, area, after);
+    if (bestShift(before, after, shift, start, length)) {
+        best = ScrollMatch{ cv::Rect(area.x, area.y + start - shift, area.width, length),
+            cv::Point(area.x, area.y + start) };
+        bestPixels = length * area.width;
+    }
+
+    hashColumns(previous, area, before);
+    hashColumns(current, area, after);
+    if (bestShift(before, after, shift, start, length) && length * area.height > bestPixels) {
+        best = ScrollMatch{ cv::Rect(area.x + start - shift, area.y, length, area.height),
+            cv::Point(area.x + start, area.y) };
+    }
+
+    return best;
+}
+
+cv::Rect ScrollDetector::changed_area(const cv::Mat& previous, const cv::Mat& current)
+{
+    const size_t rowBytes = static_cast<size_t>(current.cols) * current.elemSize();
+    const size_t pixel = current.elemSize();
+    int top = -1, bottom = -1;
+    size_t left = rowBytes, right = 0;
+
+    for (int y = 0; y < current.rows; y++) {
+        const uint8_t* a = previous.ptr<uint8_t>(y);
+        const uint8_t* b = current.ptr<uint8_t>(y);
+        if (std::memcmp(a, b, rowBytes) == 0) continue;
+
+        if (top < 0) top = y;
+        bottom = y;
+
+        size_t l = 0;
+        while (l < left && a[l] == b[l]) l++;
+        left = std::min(left, l);
+
+        size_t r = rowBytes;
+        while (r > right && a[r - 1] == b[r - 1]) r--;
+        right = std::max(right, r);
+    }
+
+    if (top < 0) return cv::Rect();
+
+    int x0 = static_cast<int>(left / pixel);
+    int x1 = static_cast<int>((right + pixel - 1) / pixel);
+    return cv::Rect(x0, top, x1 - x0, bottom - top + 1);
+}
+
+void ScrollDetector::hashRows(const cv::Mat& img, const cv::Rect& area, std::vector<uint64_t>& hashes)
+{
+    const size_t pixel = img.elemSize();
+    hashes.resize(area.height);
+    for (int y = 0; y < area.height; y++) {
+        hashes[y] = hash_bytes(img.ptr<uint8_t>(area.y + y) + area.x * pixel, area.width * pixel);
+    }
+}
+
+void ScrollDetector::hashColumns(const cv::Mat& img, const cv::Rect& area, std::vector<uint64_t>& hashes)
+{
+    hashes.assign(area.width, HASH_SEED);
+    for (int y = area.y; y < area.y + area.height; y++) {
+        const uint8_t* p = img.ptr<uint8_t>(y) + area.x * 3;
+        for (int x = 0; x < area.width; x++, p += 3) {
+            uint64_t value = p[0] | (p[1] << 8) | (p[2] << 16);
+            hashes[x] = (hashes[x] ^ value) * HASH_PRIME;
+        }
+    }
+}
+
+bool ScrollDetector::bestShift(const std::vector<uint64_t>& previous, const std::vector<uint64_t>& current,
+    int& shift, int& start, int& length)
+{
+    const int lines = static_cast<int>(current.size());
+
+    // Only lines whose content is unique can vote; blank rows would match everywhere.
+    std::unordered_map<uint64_t, int> index;
+    index.reserve(previous.size());
+    for (int i = 0; i < lines; i++) {
+        auto [it, inserted] = index.emplace(previous[i], i);
+        if (!inserted) it->second = -1;
+    }
+
+    std::unordered_map<int, int> votes;
+    for (int i = 0; i < lines; i++) {
+        auto it = index.find(current[i]);
+        if (it != index.end() && it->second >= 0 && it->second != i) {
+            votes[i - it->second]++;
+        }
+    }
+    if (votes.empty()) return false;
+
+    std::vector<std::pair<int, int>> ranked(votes.begin(), votes.end());
+    size_t candidates = std::min<size_t>(SCROLL_CANDIDATES, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + candidates, ranked.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    length = 0;
+    for (size_t c = 0; c < candidates; c++) {
+        int s = ranked[c].first;
+        int run = 0;
+        for (int i = std::max(0, s); i < std::min(lines, lines + s); i++) {
+            run = current[i] == previous[i - s] ? run + 1 : 0;
+            if (run > length) {
+                length = run;
+                start = i - run + 1;
+                shift = s;
+            }
+        }
+    }
+
+    return length >= SCROLL_MIN_LINES;
+}
@@ -0,0 +1,308 @@
+#include "../include/Stats.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+std::mutex Stats::registry_mutex_;
+std::vector<std::unique_ptr<Stats::ThreadStats>> Stats::registry_;
+std::vector<Stats::ThreadStats*> Stats::free_;
+Stats::ThreadStats Stats::retired_;
+std::mutex Stats::reporter_mutex_;
+std::condition_variable Stats::reporter_cv_;
+bool Stats::reporting_ = false;
+std::thread Stats::reporter_;
+std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::Count)> Stats::counters_{};
+
+const char* stage_name(Stage stage)
+{
+    switch (stage) {
+    case Stage::Capture:           return "capture";
+    case Stage::Encode:            return "encode";
+    case Stage::Send:              return "send";
+    case Stage::Chunk:             return "chunk";
+    case Stage::GetFrame:          return "get_frame";
+    case Stage::Decode:            return "decode";
+    case Stage::Present:           return "present";
+    case Stage::OneWay:            return "one_way";
+    case Stage::CaptureToPresent:  return "capture_to_present";
+    case Stage::Inject:            return "inject";
+    case Stage::InputDelay:        return "input_delay";
+    case Stage::ControlRtt:        return "control_rtt";
+    default:                       return "unknown";
+    }
+}
+
+const char* counter_name(Counter counter)
+{
+    switch (counter) {
+    case Counter::TileHits:          return "tile_hits";
+    case Counter::TileMisses:        return "tile_misses";
+    case Counter::TileBytesSaved:    return "tile_bytes_saved";
+    case Counter::TilesRefined:      return "tiles_refined";
+    case Counter::BufferAllocations: return "buffer_allocations";
+    case Counter::BufferReuses:      return "buffer_reuses";
+    case Counter::BytesCopied:       return "bytes_copied";
+    case Counter::ArenaGrowths:      return "arena_growths";
+    case Counter::TasksStolen:       return "tasks_stolen";
+    default:                         return "unknown";
+    }
+}
+
+static int highest_bit(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+
+// Histogram
+
+size_t Histogram::index_of(uint64_t value)
+{
+    if (value < (uint64_t(1) << SUB_BITS)) {
+        return static_cast<size_t>(value);
+    }
+
+    int msb = std::min(highest_bit(value), MAX_BITS - 1);
+    int shift = msb - (SUB_BITS - 1);
+    uint64_t sub = std::min<uint64_t>(value >> shift, 2 * HALF - 1);
+    return static_cast<size_t>(shift) * HALF + static_cast<size_t>(sub);
+}
+
+uint64_t Histogram::value_at(size_t index)
+{
+    if (index < (size_t(1) << SUB_BITS)) {
+        return index;
+    }
+
+    size_t shift = index / HALF - 1;
+    uint64_t sub = index - shift * HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t Histogram::percentile(const std::vector<uint64_t>& counts, double p)
+{
+    uint64_t total = 0;
+    for (auto c : counts) total += c;
+    if (total == 0) return 0;
+
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen > rank) return value_at(i);
+    }
+    return 0;
+}
+
+void Histogram::record(uint64_t value)
+{
+    auto& c = counts_[index_of(value)];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Histogram::merge_into(std::vector<uint64_t>& out) const
+{
+    out.resize(BUCKETS);
+    for (size_t i = 0; i < BUCKETS; i++) {
+        out[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+}
+
+// Only for a histogram no thread records into any more; out must not be written meanwhile either.
+void Histogram::merge_into(Histogram& out) const
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        auto& c = out.counts_[i];
+        c.store(c.load(std::memory_order_relaxed) + counts_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void Histogram::clear()
+{
+    for (auto& c : counts_) {
+        c.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+// Stats
+
+Stats::ThreadStats& Stats::local()
+{
+    struct Slot
+    {
+        ThreadStats* stats = acquireThread();
+        ~Slot() { retireThread(stats); }
+    };
+
+    thread_local Slot slot;
+    return *slot.stats;
+}
+
+Stats::ThreadStats* Stats::acquireThread()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    if (!free_.empty()) {
+        ThreadStats* stats = free_.back();
+        free_.pop_back();
+        return stats;
+    }
+    registry_.push_back(std::make_unique<ThreadStats>());
+    return registry_.back().get();
+}
+
+void Stats::retireThread(ThreadStats* stats)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (size_t s = 0; s < stats->stages.size(); s++) {
+        stats->stages[s].merge_into(retired_.stages[s]);
+        stats->stages[s].clear();
+    }
+    free_.push_back(stats);
+}
+
+void Stats::record(Stage stage, Clock::duration elapsed)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    local().stages[static_cast<size_t>(stage)].record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+}
+
+void Stats::add(Counter counter, uint64_t value)
+{
+    counters_[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Stats::counter(Counter counter)
+{
+    return counters_[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+}
+
+std::string Stats::report()
+{
+    std::ostringstream out;
+    out << std::left << std::setw(20) << "stage"
+        << std::right << std::setw(10) << "count"
+        << std::setw(12) << "p50_us"
+        << std::setw(12) << "p99_us"
+        << std::setw(12) << "p999_us"
+        << std::setw(12) << "max_us" << "\n";
+
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); s++) {
+        std::vector<uint64_t> counts;
+        retired_.stages[s].merge_into(counts);
+        for (auto& thread : registry_) {
+            thread->stages[s].merge_into(counts);
+        }
+
+        uint64_t total = 0;
+        for (auto c : counts) total += c;
+        if (total == 0) continue;
+
+        auto percentile = [&](double p) {
+            return Histogram::percentile(counts, p) / 1000.0;
+        };
+
+        out << std::left << std::setw(20) << stage_name(static_cast<Stage>(s))
+            << std::right << std::setw(10) << total
+            << std::fixed << std::setprecision(1)
+            << std::setw(12) << percentile(0.5)
+            << std::setw(12) << percentile(0.99)
+            << std::setw(12) << percentile(0.999)
+            << std::setw(12) << percentile(1.0) << "\n";
+    }
+
+    for (size_t c = 0; c < static_cast<size_t>(Counter::Count); c++) {
+        uint64_t value = counters_[c].load(std::memory_order_relaxed);
+        if (value == 0) continue;
+
+        out << std::left << std::setw(20) << counter_name(static_cast<Counter>(c))
+            << std::right << std::setw(10) << value << "\n";
+    }
+    return out.str();
+}
+
+bool Stats::dump(const std::string& path)
+{
+    std::ofstream file(path, std::ios::app);
+    if (!file) return false;
+
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    file << "# " << now << "\n" << report() << "\n";
+    return true;
+}
+
+void Stats::reset()
+{
+    for (auto& c : counters_) {
+        c.store(0, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (auto& histogram : retired_.stages) {
+        histogram.clear();
+    }
+    for (auto& thread : registry_) {
+        for (auto& histogram : thread->stages) {
+            histogram.clear();
+        }
+    }
+}
+
+void Stats::start_reporter(const std::string& path, std::chrono::milliseconds interval,
+    const std::string& session)
+{
+    stop_reporter();
+    reset();
+
+    if (!session.empty()) {
+        std::ofstream file(path, std::ios::app);
+        file << "## session " << session << "\n";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reporter_mutex_);
+        reporting_ = true;
+    }
+    reporter_ = std::thread(&Stats::reporterLoop, path, interval);
+}
+
+void Stats::stop_reporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(reporter_mutex_);
+        reporting_ = false;
+    }
+    reporter_cv_.notify_all();
+
+    if (reporter_.joinable())
+        reporter_.join();
+}
+
+void Stats::reporterLoop(const std::string& path, std::chrono::milliseconds interval)
+{
+    std::unique_lock<std::mutex> lock(reporter_mutex_);
+    while (reporting_) {
+        if (reporter_cv_.wait_for(lock, interval, [] { return !reporting_; })) {
+            break;
+        }
+
+        lock.unlock();
+        dump(path);
+        lock.lock();
+    }
+
+    lock.unlock();
+    dump(path);
+}
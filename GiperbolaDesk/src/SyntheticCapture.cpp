@@ -0,0 +1,194 @@
+#include "../include/SyntheticCapture.hpp"
+#include <string>
+
+
+const char* content_name(SyntheticContent content)
+{
+    switch (content) {
+    case SyntheticContent::Text:     return "text";
+    case SyntheticContent::Gradient: return "gradient";
+    case SyntheticContent::Photo:    return "photo";
+    case SyntheticContent::Video:    return "video";
+    case SyntheticContent::Scroll:   return "scroll";
+    case SyntheticContent::Switch:   return "switch";
+    case SyntheticContent::Player:   return "player";
+    default:                         return "unknown";
+    }
+}
+
+SyntheticCapture::SyntheticCapture(SyntheticContent content, int width, int height, uint32_t seed)
+    : content_(content), width_(width), height_(height), rng_(seed)
+{
+    switch (content_) {
+    case SyntheticContent::Text:
+        renderText(base_, height_);
+        drawChrome(base_);
+        break;
+    case SyntheticContent::Gradient:
+        renderGradient();
+        break;
+    case SyntheticContent::Photo:
+        renderPhoto(base_, width_, height_);
+        break;
+    case SyntheticContent::Video:
+        renderPhoto(base_, width_ + 128, height_ + 128);
+        break;
+    case SyntheticContent::Scroll:
+        renderText(base_, height_ * 4);
+        break;
+    case SyntheticContent::Switch:
+        renderGradient();
+        other_ = base_;
+        renderText(base_, height_);
+        drawChrome(base_);
+        break;
+    case SyntheticContent::Player:
+        renderText(base_, height_);
+        drawChrome(base_);
+        renderPhoto(other_, playerArea().width + 128, playerArea().height + 128);
+        break;
+    default:
+        base_ = cv::Mat(height_, width_, CV_8UC3, cv::Scalar(0, 0, 0));
+        break;
+    }
+}
+
+cv::Mat SyntheticCapture::next_frame()
+{
+    cv::Mat frame;
+    if (content_ == SyntheticContent::Video) {
+        frame.create(height_, width_, CV_8UC3);
+        renderVideo(base_, frame);
+    }
+    else if (content_ == SyntheticContent::Player) {
+        frame = base_.clone();
+        renderVideo(other_, frame(playerArea()));
+    }
+    else if (content_ == SyntheticContent::Scroll) {
+        int offset = static_cast<int>(frame_ * SYNTHETIC_SCROLL_STEP % (base_.rows - height_));
+        base_(cv::Rect(0, offset, width_, height_)).copyTo(frame);
+        drawChrome(frame);
+    }
+    else if (content_ == SyntheticContent::Switch) {
+        frame = (frame_ / SYNTHETIC_SWITCH_FRAMES) % 2 ? other_.clone() : base_.clone();
+    }
+    else {
+        frame = base_.clone();
+        if (content_ == SyntheticContent::Text) {
+            int line = static_cast<int>(frame_ % 40);
+            int caret = 60 + static_cast<int>(frame_ % 80) * 9;
+            cv::rectangle(frame, cv::Rect(caret, 90 + line * 22, 2, 16), cv::Scalar(0, 0, 0), cv::FILLED);
+        }
+    }
+
+    drawCursor(frame);
+    frame_++;
+    return frame;
+}
+
+SyntheticContent SyntheticCapture::content() const
+{
+    return content_;
+}
+
+int SyntheticCapture::width() const
+{
+    return width_;
+}
+
+int SyntheticCapture::height() const
+{
+    return height_;
+}
+
+void SyntheticCapture::renderText(cv::Mat& target, int height)
+{
+    static const char* words[] = {
+        "void", "Network::sendFrame", "const", "std::vector<uint8_t>&", "frame", "return", "true;",
+        "if", "(sent", "==", "SOCKET_ERROR)", "{", "}", "header.frameId", "for", "size_t", "i", "=", "0;"
+    };
+    std::uniform_int_distribution<size_t> pick(0, sizeof(words) / sizeof(words[0]) - 1);
+    std::uniform_int_distribution<int> count(2, 12);
+
+    target = cv::Mat(height, width_, CV_8UC3, cv::Scalar(250, 250, 250));
+    cv::rectangle(target, cv::Rect(0, 0, 48, height), cv::Scalar(235, 235, 235), cv::FILLED);
+
+    for (int y = 90; y < height - 60; y += 22) {
+        std::string text;
+        int n = count(rng_);
+        for (int i = 0; i < n; i++) {
+            text += words[pick(rng_)];
+            text += ' ';
+        }
+        cv::Scalar color = (y / 22) % 7 == 0 ? cv::Scalar(160, 40, 20) : cv::Scalar(30, 30, 30);
+        cv::putText(target, std::to_string(y / 22), cv::Point(8, y + 14), cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(150, 150, 150));
+        cv::putText(target, text, cv::Point(60, y + 14), cv::FONT_HERSHEY_PLAIN, 1.1, color);
+    }
+}
+
+void SyntheticCapture::renderGradient()
+{
+    base_ = cv::Mat(height_, width_, CV_8UC3);
+    for (int y = 0; y < height_; y++) {
+        uint8_t* row = base_.ptr<uint8_t>(y);
+        for (int x = 0; x < width_; x++) {
+            row[x * 3 + 0] = static_cast<uint8_t>(120 + 100 * y / height_);
+            row[x * 3 + 1] = static_cast<uint8_t>(60 + 80 * x / width_);
+            row[x * 3 + 2] = static_cast<uint8_t>(40 + 60 * (x + y) / (width_ + height_));
+        }
+    }
+
+    std::uniform_int_distribution<int> px(0, width_ * 3 / 4);
+    std::uniform_int_distribution<int> py(0, height_ * 3 / 4);
+    std::uniform_int_distribution<int> shade(180, 245);
+    for (int i = 0; i < 4; i++) {
+        cv::Rect window(px(rng_), py(rng_), width_ / 4, height_ / 4);
+        int s = shade(rng_);
+        cv::rectangle(base_, window, cv::Scalar(s, s, s), cv::FILLED);
+        cv::rectangle(base_, cv::Rect(window.x, window.y, window.width, 24), cv::Scalar(90, 70, 50), cv::FILLED);
+    }
+}
+
+void SyntheticCapture::renderPhoto(cv::Mat& target, int width, int height)
+{
+    cv::Mat coarse(height / 16 + 1, width / 16 + 1, CV_8UC3);
+    cv::randu(coarse, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+    cv::resize(coarse, target, cv::Size(width, height), 0, 0, cv::INTER_LINEAR);
+
+    cv::Mat detail(height, width, CV_8UC3);
+    cv::randu(detail, cv::Scalar(0, 0, 0), cv::Scalar(40, 40, 40));
+    cv::GaussianBlur(detail, detail, cv::Size(3, 3), 0);
+    cv::add(target, detail, target);
+}
+
+// Pans over a source 128 pixels larger than the target and adds fresh grain every frame.
+void SyntheticCapture::renderVideo(const cv::Mat& source, cv::Mat target) const
+{
+    int dx = static_cast<int>(frame_ * 3 % 128);
+    int dy = static_cast<int>(frame_ * 2 % 128);
+    source(cv::Rect(dx, dy, target.cols, target.rows)).copyTo(target);
+
+    cv::Mat grain(target.rows, target.cols, CV_8UC3);
+    cv::randu(grain, cv::Scalar(0, 0, 0), cv::Scalar(24, 24, 24));
+    cv::add(target, grain, target);
+}
+
+// A video player window in the right half of a text desktop.
+cv::Rect SyntheticCapture::playerArea() const
+{
+    return cv::Rect(width_ / 2, height_ / 4, width_ * 3 / 8, height_ * 3 / 8);
+}
+
+void SyntheticCapture::drawChrome(cv::Mat& frame) const
+{
+    cv::rectangle(frame, cv::Rect(0, 0, width_, 32), cv::Scalar(60, 60, 60), cv::FILLED);
+    cv::rectangle(frame, cv::Rect(0, height_ - 40, width_, 40), cv::Scalar(45, 40, 35), cv::FILLED);
+}
+
+void SyntheticCapture::drawCursor(cv::Mat& frame) const
+{
+    int x = static_cast<int>(frame_ * 7 % std::max(1, width_ - 16));
+    int y = static_cast<int>(frame_ * 5 % std::max(1, height_ - 24));
+    cv::rectangle(frame, cv::Rect(x, y, 12, 20), cv::Scalar(255, 255, 255), cv::FILLED);
+    cv::rectangle(frame, cv::Rect(x, y, 12, 20), cv::Scalar(0, 0, 0), 1);
+}
@@ -0,0 +1,51 @@
+#include "../include/TileCache.hpp"
+#include <cstring>
+
+
+static constexpr uint64_t PRIME_1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t PRIME_3 = 0x165667b19e3779f9ull;
+
+static uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME_2;
+    h ^= h >> 29;
+    h *= PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Two independent 64-bit lanes over every row, finished with the tile shape:
+// collisions between different tiles are as unlikely as for a 128-bit hash.
+TileHash tile_hash(const cv::Mat& tile)
+{
+    uint64_t a = PRIME_1 ^ static_cast<uint64_t>(tile.cols);
+    uint64_t b = PRIME_2 ^ static_cast<uint64_t>(tile.rows);
+    const size_t rowBytes = static_cast<size_t>(tile.cols) * tile.elemSize();
+
+    for (int y = 0; y < tile.rows; y++) {
+        const uint8_t* p = tile.ptr<uint8_t>(y);
+        size_t i = 0;
+        for (; i + 8 <= rowBytes; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, p + i, 8);
+            a = rotl(a ^ (word * PRIME_2), 31) * PRIME_1;
+            b = rotl(b + (word ^ PRIME_3), 27) * PRIME_2;
+        }
+        for (; i < rowBytes; i++) {
+            a = rotl(a ^ (p[i] * PRIME_3), 11) * PRIME_1;
+            b = rotl(b + p[i], 7) * PRIME_3;
+        }
+    }
+
+    TileHash hash;
+    hash.lo = avalanche(a ^ rotl(b, 17));
+    hash.hi = avalanche(b ^ rotl(a, 41) ^ rowBytes);
+    return hash;
+}
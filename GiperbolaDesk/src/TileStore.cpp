@@ -0,0 +1,158 @@
+#include "../include/TileStore.hpp"
+#include <cstring>
+#include <filesystem>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+std::string tile_store_path(const std::string& host, unsigned int port, uint8_t streamId)
+{
+    std::string name = host + "_" + std::to_string(port);
+    if (streamId != 0) name += "_" + std::to_string(streamId);
+    return (std::filesystem::path(TILE_STORE_DIR) / (name + ".bin")).string();
+}
+
+TileStore::TileStore(size_t capacity)
+    : capacity_(capacity) { }
+
+TileStore::~TileStore()
+{
+    close();
+}
+
+bool TileStore::open(const std::string& path)
+{
+    close();
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    const size_t size = fileSize();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), NULL);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    mapping_ = mapping;
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+
+    void* view = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (view == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+#endif
+
+    memory_.clear();
+    memory_.shrink_to_fit();
+    base_ = static_cast<uint8_t*>(view);
+
+    Header& h = header();
+    if (h.magic != TILE_STORE_MAGIC || h.version != TILE_STORE_VERSION ||
+        h.capacity != capacity_ || h.tileBytes != TILE_BYTES) {
+        format();
+    }
+    return true;
+}
+
+void TileStore::close()
+{
+#ifdef _WIN32
+    if (mapping_) {
+        FlushViewOfFile(base_, 0);
+        UnmapViewOfFile(base_);
+        CloseHandle(mapping_);
+        CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = nullptr;
+        base_ = nullptr;
+    }
+#else
+    if (fd_ >= 0) {
+        msync(base_, fileSize(), MS_ASYNC);
+        munmap(base_, fileSize());
+        ::close(fd_);
+        fd_ = -1;
+        base_ = nullptr;
+    }
+#endif
+}
+
+bool TileStore::persistent() const
+{
+#ifdef _WIN32
+    return mapping_ != nullptr;
+#else
+    return fd_ >= 0;
+#endif
+}
+
+size_t TileStore::capacity() const
+{
+    return capacity_;
+}
+
+TileStore::Entry& TileStore::entry(uint32_t slot)
+{
+    return reinterpret_cast<Entry*>(base() + sizeof(Header))[slot];
+}
+
+uint8_t* TileStore::pixels(uint32_t slot)
+{
+    return base() + sizeof(Header) + capacity_ * sizeof(Entry) + static_cast<size_t>(slot) * TILE_BYTES;
+}
+
+uint64_t TileStore::next_stamp()
+{
+    return ++header().stamp;
+}
+
+size_t TileStore::fileSize() const
+{
+    return sizeof(Header) + capacity_ * (sizeof(Entry) + TILE_BYTES);
+}
+
+uint8_t* TileStore::base()
+{
+    if (!base_) {
+        memory_.assign(fileSize(), 0);
+        base_ = memory_.data();
+        format();
+    }
+    return base_;
+}
+
+TileStore::Header& TileStore::header()
+{
+    return *reinterpret_cast<Header*>(base());
+}
+
+void TileStore::format()
+{
+    std::memset(base_, 0, sizeof(Header) + capacity_ * sizeof(Entry));
+    Header& h = header();
+    h.magic = TILE_STORE_MAGIC;
+    h.version = TILE_STORE_VERSION;
+    h.capacity = static_cast<uint32_t>(capacity_);
+    h.tileBytes = static_cast<uint32_t>(TILE_BYTES);
+}
@@ -0,0 +1,90 @@
+#include "../include/Trace.hpp"
+#include <algorithm>
+#include <fstream>
+
+
+std::atomic<bool> Trace::enabled_{ false };
+std::atomic<uint64_t> Trace::head_{ 0 };
+std::vector<Trace::Event> Trace::ring_;
+std::mutex Trace::names_mutex_;
+std::map<uint32_t, std::string> Trace::thread_names_;
+
+void Trace::enable(size_t capacity)
+{
+    if (enabled()) return;
+
+    ring_.assign(capacity, Event{});
+    head_ = 0;
+    enabled_ = true;
+}
+
+void Trace::disable()
+{
+    enabled_ = false;
+}
+
+uint32_t Trace::threadId()
+{
+    static std::atomic<uint32_t> next{ 1 };
+    thread_local uint32_t id = next++;
+    return id;
+}
+
+void Trace::name_thread(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(names_mutex_);
+    thread_names_[threadId()] = name;
+}
+
+void Trace::push(const Event& event)
+{
+    if (!enabled()) return;
+
+    uint64_t slot = head_.fetch_add(1, std::memory_order_relaxed);
+    ring_[slot % ring_.size()] = event;
+}
+
+void Trace::complete(const char* name, uint32_t frameId, uint64_t startUs, uint64_t endUs)
+{
+    push({ name, frameId, threadId(), startUs, endUs > startUs ? endUs - startUs : 0, 'X' });
+}
+
+void Trace::instant(const char* name, uint32_t frameId, uint64_t timeUs)
+{
+    push({ name, frameId, threadId(), timeUs, 0, 'i' });
+}
+
+bool Trace::flush(const std::string& path)
+{
+    if (ring_.empty()) return false;
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) return false;
+
+    uint64_t head = head_.load();
+    uint64_t count = std::min<uint64_t>(head, ring_.size());
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GiperbolaDesk\"}}";
+    {
+        std::lock_guard<std::mutex> lock(names_mutex_);
+        for (auto& [tid, name] : thread_names_) {
+            file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                 << ",\"args\":{\"name\":\"" << name << "\"}}";
+        }
+    }
+
+    for (uint64_t i = head - count; i < head; i++) {
+        const Event& e = ring_[i % ring_.size()];
+        if (!e.name) continue;
+
+        file << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"frame\",\"ph\":\"" << e.phase
+             << "\",\"ts\":" << e.start << ",\"pid\":1,\"tid\":" << e.thread;
+        if (e.phase == 'X') file << ",\"dur\":" << e.duration;
+        else file << ",\"s\":\"t\"";
+        file << ",\"args\":{\"frame\":" << e.frameId << "}}";
+    }
+
+    file << "\n]}\n";
+    return true;
+}
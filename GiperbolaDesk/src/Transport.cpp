@@ -0,0 +1,114 @@
+#include "../include/Transport.hpp"
+#include <cstring>
+#include <iterator>
+
+
+// FrameAssembler
+
+std::optional<ReceivedFrame> FrameAssembler::add_chunk(const ChunkHeader& header, const uint8_t* data, size_t dataSize)
+{
+    if (header.totalChunks == 0 || header.totalChunks * CHUNK_DATA_SIZE > MAX_FRAME_BYTES) return std::nullopt;
+
+    if (header.frameId <= lastCompleted_) {
+        if (lastCompleted_ - header.frameId < FRAME_RESTART_GAP) return std::nullopt;
+        reset();
+    }
+
+    auto found = frames_.find(header.frameId);
+    if (found == frames_.end()) {
+        // Give up the oldest pending frame now rather than when a later one completes, so
+        // partial or bogus frames cannot pile up.
+        while (frames_.size() >= MAX_PENDING_FRAMES) {
+            frames_.erase(frames_.begin());
+            dropped_++;
+        }
+        found = frames_.emplace(header.frameId, FrameAssembly{}).first;
+    }
+    auto& frame = found->second;
+
+    if (frame.totalChunks == 0) {
+        frame.totalChunks = header.totalChunks;
+        frame.received = static_cast<uint8_t*>(arena_.allocate(header.totalChunks, 1));
+        std::memset(frame.received, 0, header.totalChunks);
+        frame.data = BufferPool::acquire(header.totalChunks * CHUNK_DATA_SIZE);
+        frame.captureTime = header.captureTime;
+        if (Trace::enabled()) {
+            frame.firstChunkTime = monotonic_us();
+            Trace::instant("first_chunk", header.frameId, frame.firstChunkTime);
+        }
+    }
+
+    // Every chunk but the last is full, so each one is written straight to its place in the frame.
+    const size_t index = header.chunkIndex;
+    const bool last = index + 1 == frame.totalChunks;
+    if (header.totalChunks == frame.totalChunks && index < frame.totalChunks && !frame.received[index] &&
+        (last ? dataSize <= CHUNK_DATA_SIZE : dataSize == CHUNK_DATA_SIZE)) {
+        std::memcpy(frame.data.data() + index * CHUNK_DATA_SIZE, data, dataSize);
+        BufferPool::count_copy(dataSize);
+        frame.received[index] = 1;
+        frame.receivedChunks++;
+        if (last) frame.size = index * CHUNK_DATA_SIZE + dataSize;
+    }
+
+    if (frame.receivedChunks != frame.totalChunks) {
+        return std::nullopt;
+    }
+
+    uint64_t lastChunkTime = Trace::enabled() ? monotonic_us() : 0;
+
+    ReceivedFrame fullFrame;
+    fullFrame.streamId = header.streamId;
+    fullFrame.frameId = header.frameId;
+    fullFrame.captureTime = frame.captureTime;
+    frame.data.resize(frame.size);
+    fullFrame.data = std::move(frame.data);
+
+    if (lastChunkTime != 0) {
+        Trace::instant("last_chunk", header.frameId, lastChunkTime);
+        Trace::complete("receive", header.frameId, frame.firstChunkTime, lastChunkTime);
+        Trace::complete("reassemble", header.frameId, lastChunkTime, monotonic_us());
+    }
+
+    lastCompleted_ = header.frameId;
+
+    // Chunks arrive in frame order, so anything older than a completed frame is lost for good.
+    auto completed = frames_.find(header.frameId);
+    dropped_ += std::distance(frames_.begin(), completed);
+    frames_.erase(frames_.begin(), std::next(completed));
+    recycleArena();
+
+    return fullFrame;
+}
+
+uint64_t FrameAssembler::dropped_frames() const
+{
+    return dropped_;
+}
+
+size_t FrameAssembler::pending_frames() const
+{
+    return frames_.size();
+}
+
+void FrameAssembler::reset()
+{
+    frames_.clear();
+    arena_.reset();
+    lastCompleted_ = 0;
+}
+
+void FrameAssembler::recycleArena()
+{
+    if (frames_.empty()) {
+        arena_.reset();
+        return;
+    }
+
+    // Frames that keep overlapping never leave the map empty; past the limit the ones
+    // still pending are given up so the arena cannot grow without bound.
+    if (arena_.used() > ARENA_MAX_SIZE) {
+        dropped_ += frames_.size();
+        frames_.clear();
+        arena_.reset();
+    }
+}
@@ -0,0 +1,157 @@
+#include "../include/WorkerPool.hpp"
+#include <algorithm>
+#include <string>
+#include "../include/Stats.hpp"
+#include "../include/Trace.hpp"
+
+
+// WorkerPool
+
+static thread_local const WorkerPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+WorkerPool::WorkerPool(size_t workers)
+{
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < workers; i++) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < workers; i++) {
+        workers_[i]->thread = std::thread(&WorkerPool::run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        timed_.clear();
+    }
+    wake_.notify_all();
+
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+void WorkerPool::submit(Task task)
+{
+    size_t index = current_pool == this ? current_worker : next_++ % workers_.size();
+    push(index, std::move(task));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_one();
+}
+
+void WorkerPool::submit_at(Clock::time_point due, Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        timed_.push_back(Timed{ due, std::move(task) });
+        std::push_heap(timed_.begin(), timed_.end(), [](const Timed& a, const Timed& b) { return a.due > b.due; });
+        nextDue_ = timed_.front().due.time_since_epoch().count();
+    }
+    // A sleeping worker may be waiting for a later deadline than this one.
+    wake_.notify_one();
+}
+
+size_t WorkerPool::size() const
+{
+    return workers_.size();
+}
+
+void WorkerPool::run(size_t index)
+{
+    current_pool = this;
+    current_worker = index;
+    Trace::name_thread("worker " + std::to_string(index));
+
+    while (true) {
+        // Busy workers release due tasks too, or a job that keeps resubmitting itself would hold them back.
+        if (Clock::now().time_since_epoch().count() >= nextDue_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (releaseDue(index) > 1) {
+                wake_.notify_all();
+            }
+        }
+
+        Task task;
+        if (popLocal(index, task) || steal(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        // More than one task due at once: let the other workers steal the rest.
+        if (releaseDue(index) > 1) {
+            wake_.notify_all();
+        }
+        if (pending_ > 0) continue;
+        if (!running_) break;
+
+        if (timed_.empty()) {
+            wake_.wait(lock);
+        }
+        else {
+            wake_.wait_until(lock, timed_.front().due);
+        }
+    }
+}
+
+void WorkerPool::push(size_t index, Task task)
+{
+    Worker& worker = *workers_[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    pending_++;
+}
+
+bool WorkerPool::popLocal(size_t index, Task& task)
+{
+    Worker& worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) return false;
+
+    task = std::move(worker.tasks.front());
+    worker.tasks.pop_front();
+    pending_--;
+    return true;
+}
+
+bool WorkerPool::steal(size_t index, Task& task)
+{
+    for (size_t k = 1; k < workers_.size(); k++) {
+        Worker& victim = *workers_[(index + k) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) continue;
+
+        task = std::move(victim.tasks.back());
+        victim.tasks.pop_back();
+        pending_--;
+        Stats::add(Counter::TasksStolen);
+        return true;
+    }
+    return false;
+}
+
+// Called with mutex_ held: moves every task whose time has come to this worker's deque.
+size_t WorkerPool::releaseDue(size_t index)
+{
+    auto now = Clock::now();
+    size_t released = 0;
+    while (!timed_.empty() && timed_.front().due <= now) {
+        std::pop_heap(timed_.begin(), timed_.end(), [](const Timed& a, const Timed& b) { return a.due > b.due; });
+        push(index, std::move(timed_.back().task));
+        timed_.pop_back();
+        released++;
+    }
+    nextDue_ = timed_.empty() ? NO_DEADLINE : timed_.front().due.time_since_epoch().count();
+    return released;
+}
@@ -0,0 +1,415 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <new>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+#include "Codec.hpp"
+#include "FrameCodec.hpp"
+#include "SyntheticCapture.hpp"
+#include "Transport.hpp"
+
+// Microbenchmarks for the per-frame hot paths: encode, packetize, reassemble, decode,
+// plus input event serialization.
+// Arguments are (content, resolution) so regressions can be tied to a kind of screen.
+
+static const cv::Size RESOLUTIONS[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+
+// Every heap allocation in the process goes through here, so the transport benchmarks can
+// check that a warmed-up frame does not touch the heap at all.
+static std::atomic<uint64_t> heap_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+// BufferPool takes its blocks from the aligned overloads, which the ones above do not cover.
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = static_cast<size_t>(alignment);
+#ifdef _MSC_VER
+    if (void* p = _aligned_malloc(size ? size : 1, align)) return p;
+#else
+    if (void* p = std::aligned_alloc(align, (size + align) / align * align)) return p;
+#endif
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(p, alignment);
+}
+
+// Reports heap allocations per iteration since `before`; the transport paths must stay at zero.
+static void check_allocations(benchmark::State& state, uint64_t before)
+{
+    uint64_t allocations = heap_allocations.load() - before;
+    state.counters["allocs_per_frame"] = state.iterations() ? static_cast<double>(allocations) / state.iterations() : 0.0;
+    if (allocations != 0) {
+        state.SkipWithError("steady-state frame allocated on the heap");
+    }
+}
+
+struct Sample
+{
+    cv::Mat frame;
+    std::vector<uint8_t> encoded;
+    std::vector<std::vector<uint8_t>> packets;
+};
+
+static const Sample& sample(int content, int resolution)
+{
+    static std::map<std::pair<int, int>, std::unique_ptr<Sample>> corpus;
+    auto& entry = corpus[{ content, resolution }];
+    if (!entry) {
+        entry = std::make_unique<Sample>();
+        cv::Size size = RESOLUTIONS[resolution];
+        SyntheticCapture capture(static_cast<SyntheticContent>(content), size.width, size.height);
+        entry->frame = capture.next_frame();
+        entry->encoded = Codec::encode_jpg(entry->frame);
+
+        uint32_t sequence = 0;
+        Packetizer::packetize(entry->encoded.data(), entry->encoded.size(), 1, 0, 0, 1, sequence,
+            [&](const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize) {
+                std::vector<uint8_t> packet(header, header + headerSize);
+                packet.insert(packet.end(), payload, payload + payloadSize);
+                entry->packets.push_back(std::move(packet));
+                return true;
+            });
+    }
+    return *entry;
+}
+
+static void label(benchmark::State& state)
+{
+    cv::Size size = RESOLUTIONS[state.range(1)];
+    state.SetLabel(std::string(content_name(static_cast<SyntheticContent>(state.range(0)))) + "/" +
+        std::to_string(size.width) + "x" + std::to_string(size.height));
+}
+
+static void BM_Encode(benchmark::State& state)
+{
+    const Sample& s = sample(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state) {
+        auto encoded = Codec::encode_jpg(s.frame);
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    label(state);
+    state.SetBytesProcessed(state.iterations() * s.frame.total() * s.frame.elemSize());
+    state.counters["encoded_kb"] = s.encoded.size() / 1024.0;
+}
+
+static void BM_FrameEncode(benchmark::State& state)
+{
+    cv::Size size = RESOLUTIONS[state.range(1)];
+    SyntheticCapture capture(static_cast<SyntheticContent>(state.range(0)), size.width, size.height);
+    std::vector<cv::Mat> frames(KEYFRAME_INTERVAL);
+    for (auto& frame : frames) {
+        frame = capture.next_frame();
+    }
+
+    size_t bytes = 0, encoded = 0;
+    for (auto _ : state) {
+        FrameEncoder encoder;
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto update = encoder.encode(frames[i], static_cast<uint32_t>(i + 1));
+            bytes += update.size();
+        }
+        encoded += frames.size();
+    }
+    label(state);
+    state.SetItemsProcessed(encoded);
+    state.counters["kb_per_frame"] = encoded ? bytes / 1024.0 / encoded : 0.0;
+}
+
+static void BM_Packetize(benchmark::State& state)
+{
+    const Sample& s = sample(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    uint32_t sequence = 0;
+    uint64_t allocations = heap_allocations.load();
+    for (auto _ : state) {
+        size_t total = 0;
+        Packetizer::packetize(s.encoded.data(), s.encoded.size(), 1, 0, 0, 1, sequence,
+            [&](const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize) {
+                benchmark::DoNotOptimize(header);
+                benchmark::DoNotOptimize(payload);
+                total += headerSize + payloadSize;
+                return true;
+            });
+        benchmark::DoNotOptimize(total);
+    }
+    check_allocations(state, allocations);
+    label(state);
+    state.SetBytesProcessed(state.iterations() * s.encoded.size());
+    state.counters["chunks"] = static_cast<double>(s.packets.size());
+}
+
+static void BM_Reassemble(benchmark::State& state)
+{
+    const Sample& s = sample(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    FrameAssembler assembler;
+    uint32_t frameId = 1;
+    auto reassemble = [&]() {
+        std::optional<ReceivedFrame> frame;
+        for (auto& packet : s.packets) {
+            ChunkHeader header;
+            header.read(packet.data(), packet.size());
+            header.frameId = frameId;
+            frame = assembler.add_chunk(header, packet.data() + ChunkHeader::SIZE, packet.size() - ChunkHeader::SIZE);
+        }
+        frameId++;
+        return frame && frame->data.size() == s.encoded.size();
+    };
+
+    // The first frame sizes the arena and the buffer pool.
+    reassemble();
+    uint64_t allocations = heap_allocations.load();
+    for (auto _ : state) {
+        if (!reassemble()) {
+            state.SkipWithError("reassembled frame does not match");
+            break;
+        }
+    }
+    check_allocations(state, allocations);
+    label(state);
+    state.SetBytesProcessed(state.iterations() * s.encoded.size());
+}
+
+static void BM_Decode(benchmark::State& state)
+{
+    const Sample& s = sample(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    std::vector<uint8_t> rgba;
+    int width = 0, height = 0;
+    for (auto _ : state) {
+        if (!Codec::decode_rgba(s.encoded.data(), s.encoded.size(), rgba, width, height)) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(rgba.data());
+    }
+    label(state);
+    state.SetBytesProcessed(state.iterations() * s.frame.total() * s.frame.elemSize());
+}
+
+// Lossless candidates next to the JPEG baseline, on whole frames.
+
+static const char* const IMAGE_CODECS[] = { "jpeg", "png", "qoi" };
+
+static bool encode_image(int codec, const cv::Mat& frame, std::vector<uint8_t>& out)
+{
+    if (codec == 1) {
+        std::vector<uchar> png;
+        if (!cv::imencode(".png", frame, png, { cv::IMWRITE_PNG_COMPRESSION, 1 })) return false;
+        out.assign(png.begin(), png.end());
+        return true;
+    }
+    return Codec::encode(codec == 2 ? PixelCodec::Qoi : PixelCodec::Jpeg, frame, out);
+}
+
+static bool decode_image(int codec, const std::vector<uint8_t>& data, const cv::Mat& frame, std::vector<uint8_t>& rgba)
+{
+    if (codec == 2) return Codec::decode_qoi(data.data(), data.size(), frame.cols, frame.rows, rgba);
+
+    int width = 0, height = 0;
+    return Codec::decode_rgba(data.data(), data.size(), rgba, width, height);
+}
+
+static void BM_ImageEncode(benchmark::State& state)
+{
+    const Sample& s = sample(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const int codec = static_cast<int>(state.range(2));
+    std::vector<uint8_t> encoded;
+    for (auto _ : state) {
+        if (!encode_image(codec, s.frame, encoded)) {
+            state.SkipWithError("encode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    state.SetLabel(IMAGE_CODECS[codec] + std::string("/") + content_name(static_cast<SyntheticContent>(state.range(0))));
+    state.SetBytesProcessed(state.iterations() * s.frame.total() * s.frame.elemSize());
+    state.counters["ratio"] = encoded.empty() ? 0.0 : static_cast<double>(s.frame.total() * s.frame.elemSize()) / encoded.size();
+}
+
+static void BM_ImageDecode(benchmark::State& state)
+{
+    const Sample& s = sample(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const int codec = static_cast<int>(state.range(2));
+    std::vector<uint8_t> encoded, rgba;
+    if (!encode_image(codec, s.frame, encoded)) {
+        state.SkipWithError("encode failed");
+        return;
+    }
+    for (auto _ : state) {
+        if (!decode_image(codec, encoded, s.frame, rgba)) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(rgba.data());
+    }
+    state.SetLabel(IMAGE_CODECS[codec] + std::string("/") + content_name(static_cast<SyntheticContent>(state.range(0))));
+    state.SetBytesProcessed(state.iterations() * s.frame.total() * s.frame.elemSize());
+}
+
+// One event of every type, with negative coordinates and deltas as sent for a secondary monitor.
+static std::vector<EventPacket> event_corpus()
+{
+    std::vector<EventPacket> events(5);
+    events[0].type = EventType::MouseMove;
+    events[0].payload = MouseMoveData{ -1920, 1079 };
+    events[1].type = EventType::MouseLeftClick;
+    events[1].payload = MouseClickData{ 640, -12 };
+    events[2].type = EventType::MouseRightClick;
+    events[2].payload = MouseClickData{ 0, 0 };
+    events[3].type = EventType::MouseWheel;
+    events[3].payload = MouseWheelData{ 300, 200, -3 };
+    events[4].type = EventType::KeyPress;
+    events[4].payload = KeyPressData{ 57 };
+    return events;
+}
+
+static bool same_event(const EventPacket& a, const EventPacket& b)
+{
+    return a.type == b.type && a.payload.index() == b.payload.index() && std::visit([&](auto&& value) {
+        using T = std::decay_t<decltype(value)>;
+        return std::memcmp(&value, &std::get<T>(b.payload), sizeof(T)) == 0;
+        }, a.payload);
+}
+
+static void BM_EventEncode(benchmark::State& state)
+{
+    const auto events = event_corpus();
+    uint8_t packet[EventPacket::MAX_SIZE];
+    uint64_t allocations = heap_allocations.load();
+    for (auto _ : state) {
+        for (auto& event : events) {
+            benchmark::DoNotOptimize(event.write(packet));
+            benchmark::ClobberMemory();
+        }
+    }
+    check_allocations(state, allocations);
+    state.SetItemsProcessed(state.iterations() * events.size());
+}
+
+static void BM_EventDecode(benchmark::State& state)
+{
+    const auto events = event_corpus();
+    std::vector<std::vector<uint8_t>> packets;
+    for (auto& event : events) {
+        uint8_t packet[EventPacket::MAX_SIZE];
+        packets.emplace_back(packet, packet + event.write(packet));
+    }
+
+    // Round trip first: every event must come back exactly as it was written.
+    for (size_t i = 0; i < events.size(); i++) {
+        EventPacket decoded;
+        if (packets[i].empty() || !decoded.read(packets[i].data(), packets[i].size()) || !same_event(decoded, events[i])) {
+            state.SkipWithError("event does not survive the round trip");
+            return;
+        }
+    }
+
+    uint64_t allocations = heap_allocations.load();
+    for (auto _ : state) {
+        for (auto& packet : packets) {
+            EventPacket decoded;
+            benchmark::DoNotOptimize(decoded.read(packet.data(), packet.size()));
+            benchmark::DoNotOptimize(decoded);
+        }
+    }
+    check_allocations(state, allocations);
+    state.SetItemsProcessed(state.iterations() * packets.size());
+}
+
+// One poll cycle of a 1000 Hz mouse: sixteen moves along a short path, packed and unpacked.
+static void BM_InputBatch(benchmark::State& state)
+{
+    std::vector<EventPacket> events(16);
+    for (size_t i = 0; i < events.size(); i++) {
+        events[i].type = EventType::MouseMove;
+        events[i].payload = MouseMoveData{ 800 + static_cast<int>(i) * 3, 450 - static_cast<int>(i) };
+    }
+
+    InputBatchPacket batch;
+    size_t decoded = 0, mismatched = 0, bytes = 0;
+    uint64_t allocations = heap_allocations.load();
+    for (auto _ : state) {
+        batch.clear();
+        for (auto& event : events) {
+            batch.add(event);
+        }
+        bytes = batch.size();
+        decoded = 0;
+        InputBatchPacket::read(batch.data(), batch.size(), [&](const EventPacket& event) {
+            if (!same_event(event, events[decoded])) mismatched++;
+            decoded++;
+        });
+    }
+    if (decoded != events.size() || mismatched != 0) {
+        state.SkipWithError("batch does not survive the round trip");
+        return;
+    }
+    check_allocations(state, allocations);
+    state.SetItemsProcessed(state.iterations() * events.size());
+    state.counters["bytes_per_event"] = static_cast<double>(bytes) / events.size();
+}
+
+static void corpus_args(benchmark::internal::Benchmark* b)
+{
+    for (int content = 0; content < static_cast<int>(SyntheticContent::Count); content++) {
+        for (int resolution = 0; resolution < 3; resolution++) {
+            b->Args({ content, resolution });
+        }
+    }
+    b->ArgNames({ "content", "res" })->Unit(benchmark::kMicrosecond);
+}
+
+static void codec_args(benchmark::internal::Benchmark* b)
+{
+    for (int content = 0; content < static_cast<int>(SyntheticContent::Count); content++) {
+        for (int codec = 0; codec < 3; codec++) {
+            b->Args({ content, 1, codec });
+        }
+    }
+    b->ArgNames({ "content", "res", "codec" })->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK(BM_Encode)->Apply(corpus_args);
+BENCHMARK(BM_FrameEncode)->Apply(corpus_args);
+BENCHMARK(BM_Packetize)->Apply(corpus_args);
+BENCHMARK(BM_Reassemble)->Apply(corpus_args);
+BENCHMARK(BM_Decode)->Apply(corpus_args);
+BENCHMARK(BM_ImageEncode)->Apply(codec_args);
+BENCHMARK(BM_ImageDecode)->Apply(codec_args);
+BENCHMARK(BM_EventEncode);
+BENCHMARK(BM_EventDecode);
+BENCHMARK(BM_InputBatch);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,593 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include "FrameCodec.hpp"
+#include "HostDaemon.hpp"
+#include "Network.hpp"
+#include "Stats.hpp"
+#include "SyntheticCapture.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// End-to-end loopback run: a synthetic sender and a headless viewer, each on the real
+// Network path, talk over 127.0.0.1. An optional relay in between drops and delays datagrams.
+
+// The viewer's window loop runs at about display rate; input produced in between is handed
+// over in one pass.
+constexpr auto INPUT_POLL_INTERVAL = std::chrono::microseconds(16667);
+
+struct Options
+{
+    SyntheticContent content = SyntheticContent::Text;
+    int width = 1920;
+    int height = 1080;
+    int fps = 30;
+    int seconds = 10;
+    int quality = 85;
+    bool lossless = false;
+    double loss = 0.0;
+    int delayMs = 0;
+    int jitterMs = 0;
+    int streams = 1;
+    int peers = 1;
+    bool daemon = false;
+    int workers = 0;
+    double cpuBudget = 0.0;
+    cv::Rect viewport;
+    unsigned int port = 19500;
+    std::string trace;
+    std::string tileStore;
+    int inputHz = 0;
+    bool inputUnbatched = false;
+    int injectDelayUs = 0;
+    int probeHz = 0;
+};
+
+static double process_cpu_seconds()
+{
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    auto to_seconds = [](const FILETIME& t) {
+        return ((static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 1e7;
+    };
+    return to_seconds(kernel) + to_seconds(user);
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+static bool parse(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--content") {
+            bool found = false;
+            for (int c = 0; c < static_cast<int>(SyntheticContent::Count); c++) {
+                if (value == content_name(static_cast<SyntheticContent>(c))) {
+                    options.content = static_cast<SyntheticContent>(c);
+                    found = true;
+                }
+            }
+            if (!found) return false;
+        }
+        else if (key == "--size") {
+            auto x = value.find('x');
+            if (x == std::string::npos) return false;
+            options.width = std::atoi(value.substr(0, x).c_str());
+            options.height = std::atoi(value.substr(x + 1).c_str());
+        }
+        else if (key == "--fps") options.fps = std::atoi(value.c_str());
+        else if (key == "--seconds") options.seconds = std::atoi(value.c_str());
+        else if (key == "--quality") options.quality = std::atoi(value.c_str());
+        else if (key == "--lossless") options.lossless = true;
+        else if (key == "--loss") options.loss = std::atof(value.c_str()) / 100.0;
+        else if (key == "--delay") options.delayMs = std::atoi(value.c_str());
+        else if (key == "--jitter") options.jitterMs = std::atoi(value.c_str());
+        else if (key == "--streams") options.streams = std::atoi(value.c_str());
+        else if (key == "--peers") options.peers = std::atoi(value.c_str());
+        else if (key == "--daemon") options.daemon = true;
+        else if (key == "--workers") options.workers = std::atoi(value.c_str());
+        else if (key == "--cpu-budget") options.cpuBudget = parse_cpu_budget(value.c_str());
+        else if (key == "--viewport") {
+            int x, y, width, height;
+            if (std::sscanf(value.c_str(), "%d,%d,%dx%d", &x, &y, &width, &height) != 4) return false;
+            options.viewport = cv::Rect(x, y, width, height);
+        }
+        else if (key == "--port") options.port = static_cast<unsigned int>(std::atoi(value.c_str()));
+        else if (key == "--trace") options.trace = value;
+        else if (key == "--tile-store") options.tileStore = value;
+        else if (key == "--input") options.inputHz = std::atoi(value.c_str());
+        else if (key == "--input-unbatched") options.inputUnbatched = true;
+        else if (key == "--inject-delay") options.injectDelayUs = std::atoi(value.c_str());
+        else if (key == "--probe") options.probeHz = std::atoi(value.c_str());
+        else return false;
+    }
+    return options.width > 0 && options.height > 0 && options.seconds > 0 &&
+        options.streams > 0 && options.streams <= static_cast<int>(MAX_STREAMS) &&
+        options.peers > 0 && options.peers <= static_cast<int>(MAX_SESSIONS) && options.workers >= 0;
+}
+
+
+// Relay
+
+class Relay
+{
+public:
+    Relay(const Options& options, unsigned int listenPort, unsigned int targetPort)
+        : loss_(options.loss), delayUs_(options.delayMs * 1000), jitterUs_(options.jitterMs * 1000)
+    {
+        socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in local{};
+        make_address("127.0.0.1", listenPort, local);
+        make_address("127.0.0.1", targetPort, target_);
+        if (socket_ == INVALID_SOCKET || bind(socket_, (sockaddr*)&local, sizeof(local)) == SOCKET_ERROR) {
+            throw std::runtime_error("Relay bind failed");
+        }
+
+#ifdef _WIN32
+        DWORD timeout = 1;
+#else
+        timeval timeout{ 0, 1000 };
+#endif
+        setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+        running_ = true;
+        thread_ = std::thread(&Relay::loop, this);
+    }
+
+    ~Relay()
+    {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        closesocket(socket_);
+    }
+
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    void loop()
+    {
+        std::vector<uint8_t> buffer(64 * 1024);
+        std::multimap<uint64_t, std::vector<uint8_t>> pending;
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        std::uniform_int_distribution<int> jitter(0, std::max(0, jitterUs_));
+
+        while (running_) {
+            int received = recvfrom(socket_, reinterpret_cast<char*>(buffer.data()), static_cast<int>(buffer.size()), 0, nullptr, nullptr);
+            uint64_t now = monotonic_us();
+
+            if (received > 0) {
+                if (chance(rng) < loss_) {
+                    dropped_++;
+                }
+                else {
+                    uint64_t due = now + delayUs_ + jitter(rng);
+                    pending.emplace(due, std::vector<uint8_t>(buffer.begin(), buffer.begin() + received));
+                }
+            }
+
+            while (!pending.empty() && pending.begin()->first <= now) {
+                auto& packet = pending.begin()->second;
+                sendto(socket_, reinterpret_cast<const char*>(packet.data()), static_cast<int>(packet.size()), 0,
+                    reinterpret_cast<const sockaddr*>(&target_), sizeof(target_));
+                pending.erase(pending.begin());
+            }
+        }
+    }
+
+private:
+    SOCKET socket_;
+    sockaddr_in target_{};
+    double loss_;
+    int delayUs_, jitterUs_;
+    std::atomic<bool> running_{ false };
+    std::atomic<uint64_t> dropped_{ 0 };
+    std::thread thread_;
+};
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse(argc, argv, options)) {
+        std::cerr << "usage: desk_loopback_bench [--content=text|gradient|photo|video|scroll|switch|player] [--size=WxH] [--fps=N]\n"
+                     "                           [--seconds=N] [--quality=N] [--lossless] [--loss=PERCENT]\n"
+                     "                           [--delay=MS] [--jitter=MS] [--streams=N] [--viewport=X,Y,WxH] [--port=N]\n"
+                     "                           [--trace=FILE] [--tile-store=FILE] [--input=HZ] [--input-unbatched]\n"
+                     "                           [--inject-delay=US] [--probe=HZ] [--peers=N] [--daemon] [--workers=N]\n"
+                     "                           [--cpu-budget=PERCENT%|CORES]\n";
+        return 1;
+    }
+
+    // Only the daemon's host streams know about a CPU budget.
+    if (options.cpuBudget > 0) options.daemon = true;
+
+    // Every end also takes the port after its own for control traffic.
+    const unsigned int rxPort = options.port;
+    const unsigned int relayPort = options.port + 2;
+    const unsigned int txPort = options.port + 4;
+    const bool impaired = options.loss > 0.0 || options.delayMs > 0 || options.jitterMs > 0;
+
+    socket_startup();
+    if (!options.trace.empty()) {
+        Trace::enable();
+        Trace::name_thread("capture");
+    }
+
+    Network receiver;
+    Network sender;
+    // Stands in for OS injection, which does nothing off Windows; a delay mimics a busy desktop.
+    sender.set_input_injector([&](EventType, const EventPayload&) {
+        if (options.injectDelayUs > 0) std::this_thread::sleep_for(std::chrono::microseconds(options.injectDelayUs));
+    });
+    receiver.open("127.0.0.1", rxPort, "127.0.0.1", txPort);
+    // Further hosts stream to the same viewer; it shows the first one and only decodes the rest.
+    // With --daemon all of them are sessions of one HostDaemon, started when sending begins.
+    std::vector<std::unique_ptr<Network>> peers;
+    std::unique_ptr<HostDaemon> daemon;
+    std::atomic<uint32_t> shownSession{ 0 };
+    if (!options.daemon) {
+        sender.open("127.0.0.1", txPort, "127.0.0.1", impaired ? relayPort : rxPort);
+        shownSession = sender.session_id();
+        for (int i = 1; i < options.peers; i++) {
+            peers.push_back(std::make_unique<Network>());
+            peers.back()->open("127.0.0.1", txPort + 2 * i, "127.0.0.1", impaired ? relayPort : rxPort);
+        }
+    }
+    std::unique_ptr<Relay> relay, controlRelay;
+    if (impaired) {
+        relay = std::make_unique<Relay>(options, relayPort, rxPort);
+        controlRelay = std::make_unique<Relay>(options, relayPort + CONTROL_PORT_OFFSET, rxPort + CONTROL_PORT_OFFSET);
+    }
+
+    std::atomic<bool> running{ true };
+    std::atomic<uint64_t> framesSent{ 0 };
+    std::atomic<uint64_t> bytesSent{ 0 };
+    std::atomic<uint64_t> keyframeRequests{ 0 };
+    Histogram latency;
+    std::map<uint32_t, uint64_t> shownPerSession;
+
+    // Every stream stands in for one monitor: its own capture thread and encoder, one decoder per stream on the viewer.
+    const uint8_t streams = static_cast<uint8_t>(options.streams);
+    auto store_path = [&](uint8_t streamId) {
+        return streamId == 0 ? options.tileStore : options.tileStore + "." + std::to_string(streamId);
+    };
+
+    std::thread viewer([&] {
+        Trace::name_thread("viewer");
+        struct ViewedStream
+        {
+            FrameDecoder decoder;
+            uint32_t lastShown = 0;
+            std::chrono::steady_clock::time_point lastRequest;
+        };
+        std::vector<ViewedStream> views(streams);
+        for (uint8_t i = 0; i < streams; i++) {
+            views[i].lastRequest = std::chrono::steady_clock::now() - KEYFRAME_REQUEST_INTERVAL;
+            if (!options.tileStore.empty() && !views[i].decoder.attach_store(store_path(i))) {
+                std::cerr << "failed to open tile store " << store_path(i) << "\n";
+            }
+        }
+        // Frames of the other peers go to decoders of their own and get no acks or keyframe requests.
+        std::map<uint32_t, bool> primary;
+        std::map<std::pair<uint32_t, uint8_t>, FrameDecoder> others;
+        auto lastViewport = std::chrono::steady_clock::now() - CLOCK_SYNC_INTERVAL;
+        auto lastProbe = std::chrono::steady_clock::now();
+        while (running) {
+            // Clock requests double as control probes: their round trip lands in control_rtt.
+            if (options.probeHz > 0 && std::chrono::steady_clock::now() - lastProbe >= std::chrono::microseconds(1000000 / options.probeHz)) {
+                receiver.sync_clock();
+                lastProbe = std::chrono::steady_clock::now();
+            }
+            for (uint8_t i = 0; i < streams; i++) {
+                if (receiver.tile_cache_requested(i)) {
+                    receiver.send_tile_cache(views[i].decoder.cached_tiles(), i);
+                }
+            }
+            if (std::chrono::steady_clock::now() - lastViewport >= CLOCK_SYNC_INTERVAL) {
+                receiver.subscribe(static_cast<uint8_t>((1u << streams) - 1));
+                for (uint8_t i = 0; i < streams && !options.viewport.empty(); i++) {
+                    receiver.send_viewport(options.viewport, i);
+                }
+                lastViewport = std::chrono::steady_clock::now();
+            }
+
+            auto frame = receiver.get_frame();
+            if (!frame) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+            if (frame->streamId >= streams) continue;
+
+            if (!primary.count(frame->session)) {
+                // A daemon session can deliver its first frame before add_session() returned.
+                if (shownSession == 0) continue;
+                for (const SessionStats& session : receiver.sessions()) {
+                    if (session.id == frame->session) primary[frame->session] = session.sessionId == shownSession;
+                }
+            }
+            if (!primary[frame->session]) {
+                if (others[{ frame->session, frame->streamId }].apply(frame->data.data(), frame->data.size(), frame->frameId)) {
+                    shownPerSession[frame->session]++;
+                    receiver.frame_presented(*frame);
+                }
+                continue;
+            }
+
+            ViewedStream& view = views[frame->streamId];
+            bool applied;
+            {
+                StageTimer timer(Stage::Decode);
+                TraceSpan span("decode", frame->frameId);
+                applied = view.decoder.apply(frame->data.data(), frame->data.size(), frame->frameId);
+            }
+            if (!applied) {
+                auto now = std::chrono::steady_clock::now();
+                if (now - view.lastRequest >= KEYFRAME_REQUEST_INTERVAL) {
+                    receiver.request_keyframe(view.lastShown, frame->streamId);
+                    keyframeRequests++;
+                    view.lastRequest = now;
+                }
+                continue;
+            }
+            view.lastShown = frame->frameId;
+            shownPerSession[frame->session]++;
+            receiver.ack_frame(frame->frameId, frame->streamId);
+            receiver.frame_presented(*frame);
+            latency.record((monotonic_us() - frame->captureTime) * 1000);
+        }
+    });
+
+    std::vector<std::unique_ptr<FrameEncoder>> encoders;
+    for (uint8_t i = 0; i < streams; i++) {
+        encoders.push_back(std::make_unique<FrameEncoder>(options.quality, options.lossless));
+    }
+    std::vector<std::unique_ptr<FrameEncoder>> peerEncoders;
+    for (size_t i = 0; i < peers.size() * streams; i++) {
+        peerEncoders.push_back(std::make_unique<FrameEncoder>(options.quality, options.lossless));
+    }
+
+    std::atomic<uint64_t> firstFrameBytes{ 0 };
+    std::atomic<uint64_t> seededTiles{ 0 };
+    std::atomic<uint64_t> motionFrames{ 0 };
+    std::atomic<uint64_t> regionFrames{ 0 };
+    Stats::reset();
+    double cpuStart = process_cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(options.seconds);
+    auto interval = options.fps > 0 ? std::chrono::microseconds(1000000 / options.fps) : std::chrono::microseconds(0);
+
+    auto send_stream = [&](Network& host, FrameEncoder& encoder, uint8_t streamId) {
+        if (streamId != 0) Trace::name_thread("capture " + std::to_string(streamId));
+        SyntheticCapture capture(options.content, options.width, options.height);
+        if (!options.tileStore.empty()) {
+            host.request_tile_cache(streamId);
+            auto waitUntil = std::chrono::steady_clock::now() + CACHE_ANNOUNCE_WAIT;
+            std::optional<std::vector<CacheEntry>> entries;
+            while (!(entries = host.take_tile_cache(streamId)) && std::chrono::steady_clock::now() < waitUntil) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            if (entries) {
+                encoder.seed_cache(*entries);
+                seededTiles += entries->size();
+            }
+        }
+
+        bool first = true;
+        std::vector<uint32_t> acks;
+        auto next = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (host.keyframe_requested(streamId)) {
+                encoder.request_keyframe();
+            }
+            host.take_acks(acks, streamId);
+            for (uint32_t acked : acks) {
+                encoder.confirm_frame(acked);
+            }
+            if (auto viewport = host.take_viewport(streamId)) {
+                encoder.set_viewport(*viewport);
+            }
+
+            uint32_t frameId = host.next_frame_id(streamId);
+            uint64_t captureTime = monotonic_us();
+            cv::Mat frame;
+            {
+                StageTimer timer(Stage::Capture);
+                TraceSpan span("capture", frameId);
+                frame = capture.next_frame();
+            }
+
+            FrameBuffer encoded;
+            {
+                TraceSpan span("encode", frameId);
+                encoded = encoder.encode(frame, frameId);
+            }
+            host.sendFrame(encoded, captureTime, streamId);
+            if (first && streamId == 0 && &host == &sender) firstFrameBytes = encoded.size();
+            first = false;
+            if (encoder.motion_mode()) motionFrames++;
+            if (!encoder.video_regions().empty()) regionFrames++;
+            framesSent++;
+            bytesSent += encoded.size();
+
+            if (options.fps > 0) {
+                next += interval;
+                std::this_thread::sleep_until(next);
+            }
+        }
+    };
+
+    // Pointer motion at the rate of a gaming mouse, with a click every 50 events. The viewer
+    // gets it in bursts once per poll cycle and either sends every event or one batch.
+    std::atomic<uint64_t> inputSent{ 0 };
+    std::thread input;
+    if (options.inputHz > 0) {
+        input = std::thread([&] {
+            const size_t perCycle = std::max<size_t>(1, options.inputHz * INPUT_POLL_INTERVAL.count() / 1000000);
+            uint64_t count = 0;
+            auto next = std::chrono::steady_clock::now();
+            while (std::chrono::steady_clock::now() < deadline) {
+                next += INPUT_POLL_INTERVAL;
+                std::this_thread::sleep_until(next);
+                for (size_t i = 0; i < perCycle; i++, count++) {
+                    int x = static_cast<int>(options.width / 2 + options.width / 4 * std::cos(count * 0.01));
+                    int y = static_cast<int>(options.height / 2 + options.height / 4 * std::sin(count * 0.01));
+                    EventType type = count % 50 == 49 ? EventType::MouseLeftClick : EventType::MouseMove;
+                    EventPayload payload = type == EventType::MouseMove ? EventPayload(MouseMoveData{ x, y }) : EventPayload(MouseClickData{ x, y });
+                    if (options.inputUnbatched) {
+                        receiver.send_event(type, payload);
+                    }
+                    else {
+                        receiver.queue_event(type, payload);
+                    }
+                }
+                receiver.flush_events();
+                inputSent += perCycle;
+            }
+        });
+    }
+
+    if (options.daemon) {
+        std::vector<MonitorInfo> monitors(streams);
+        for (MonitorInfo& monitor : monitors) {
+            monitor.width = static_cast<uint16_t>(options.width);
+            monitor.height = static_cast<uint16_t>(options.height);
+        }
+        daemon = std::make_unique<HostDaemon>([&](const MonitorInfo&) -> FrameSource {
+            auto capture = std::make_shared<SyntheticCapture>(options.content, options.width, options.height);
+            return [capture] { return capture->next_frame(); };
+        }, monitors, static_cast<size_t>(options.workers), options.cpuBudget);
+        for (int i = 0; i < options.peers; i++) {
+            SessionConfig config;
+            config.localIp = "127.0.0.1";
+            config.localPort = txPort + 2 * i;
+            config.viewerIp = "127.0.0.1";
+            config.viewerPort = impaired ? relayPort : rxPort;
+            config.quality = options.quality;
+            config.lossless = options.lossless;
+            config.fps = options.fps;
+            Network& session = daemon->add_session(config);
+            if (i == 0) shownSession = session.session_id();
+        }
+        std::this_thread::sleep_until(deadline);
+        daemon->stop();
+        for (int i = 0; i < options.peers; i++) {
+            for (uint8_t streamId = 0; streamId < streams; streamId++) {
+                framesSent += daemon->session(i).next_frame_id(streamId) - 1;
+            }
+        }
+    }
+    else {
+        std::vector<std::thread> extraStreams;
+        for (uint8_t i = 1; i < streams; i++) {
+            extraStreams.emplace_back(send_stream, std::ref(sender), std::ref(*encoders[i]), i);
+        }
+        for (size_t peer = 0; peer < peers.size(); peer++) {
+            for (uint8_t i = 0; i < streams; i++) {
+                extraStreams.emplace_back(send_stream, std::ref(*peers[peer]), std::ref(*peerEncoders[peer * streams + i]), i);
+            }
+        }
+        send_stream(sender, *encoders[0], 0);
+        for (auto& stream : extraStreams) {
+            stream.join();
+        }
+    }
+    if (input.joinable()) input.join();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200 + options.delayMs + options.jitterMs));
+    running = false;
+    viewer.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = process_cpu_seconds() - cpuStart;
+    NetworkStats rx = receiver.stats();
+    NetworkStats tx = (daemon ? daemon->session(0) : sender).stats();
+
+    std::vector<uint64_t> counts;
+    latency.merge_into(counts);
+    TileCacheStats tiles;
+    for (auto& encoder : encoders) {
+        const TileCacheStats& stream = encoder->cache_stats();
+        tiles.hits += stream.hits;
+        tiles.misses += stream.misses;
+        tiles.bytesSaved += stream.bytesSaved;
+        tiles.refined += stream.refined;
+    }
+    uint64_t lookups = tiles.hits + tiles.misses;
+    auto ms = [&](double p) { return Histogram::percentile(counts, p) / 1e6; };
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "content          " << content_name(options.content) << " " << options.width << "x" << options.height << (options.lossless ? " lossless" : "") << "\n"
+        << "streams          " << options.streams << "\n"
+        << "impairment       loss " << options.loss * 100 << "% delay " << options.delayMs << " ms jitter " << options.jitterMs << " ms\n"
+        << "frames sent      " << framesSent << "\n"
+        << "frames shown     " << rx.framesDisplayed << "\n"
+        << "sustained fps    " << rx.framesDisplayed / elapsed << "\n"
+        << "goodput          " << rx.bytesReceived * 8.0 / elapsed / 1e6 << " Mbit/s\n"
+        << "completion       " << (framesSent ? 100.0 * rx.framesReceived / framesSent : 0.0) << " %\n"
+        << "incomplete       " << rx.framesIncomplete << " frames\n"
+        << "motion mode      " << motionFrames << " frames, " << keyframeRequests << " keyframes requested\n"
+        << "video regions    " << regionFrames << " frames\n"
+        << "chunks lost      " << rx.chunksLost << (relay ? " (relay dropped " + std::to_string(relay->dropped() + controlRelay->dropped()) + ")" : "") << "\n"
+        << "cpu per frame    " << (framesSent ? cpu * 1000.0 / framesSent : 0.0) << " ms\n"
+        << "tile cache       " << (lookups ? 100.0 * tiles.hits / lookups : 0.0) << " % hit, " << tiles.bytesSaved / 1e6 << " MB saved, " << tiles.refined << " refined\n"
+        << "first frame      " << firstFrameBytes / 1e3 << " KB (" << seededTiles << " tiles seeded from the viewer)\n"
+        << "latency p50      " << ms(0.5) << " ms\n"
+        << "latency p99      " << ms(0.99) << " ms\n"
+        << "latency p999     " << ms(0.999) << " ms\n";
+    if (daemon && options.cpuBudget > 0) {
+        CpuGovernor::Status governor = daemon->governor_status();
+        std::cout << "cpu budget       " << governor.budget * 100 << " % of a core, last second used " << governor.usage * 100
+            << " % at " << governor.fps << " fps per stream, quality " << GOVERNOR_QUALITY[governor.qualityStep]
+            << " max, scale " << GOVERNOR_SCALE[governor.scaleStep] << "\n";
+    }
+    if (options.inputHz > 0) {
+        std::cout << "input            " << tx.inputEvents << " of " << inputSent << " events in " << tx.inputPackets
+            << " datagrams (" << tx.inputPackets / elapsed << "/s" << (options.inputUnbatched ? ", unbatched" : "") << "), "
+            << tx.inputMerged << " moves merged, " << tx.inputDropped << " dropped\n";
+    }
+    if (options.peers > 1) {
+        for (const SessionStats& session : receiver.sessions()) {
+            std::cout << "session " << session.id << "        " << session.address << ":" << session.port
+                << (session.sessionId == shownSession ? " (shown)" : "") << ", " << session.framesReceived << " frames, "
+                << shownPerSession[session.id] << " decoded, " << session.framesIncomplete << " incomplete, "
+                << session.chunksLost << " chunks lost\n";
+        }
+        if (rx.sessionsRejected) std::cout << "sessions         " << rx.sessionsRejected << " rejected\n";
+    }
+    std::cout << "\n" << Stats::report();
+
+    relay.reset();
+    controlRelay.reset();
+    sender.stop();
+    for (auto& peer : peers) {
+        peer->stop();
+    }
+    daemon.reset();
+    receiver.stop();
+    if (!options.trace.empty() && !Trace::flush(options.trace)) {
+        std::cerr << "failed to write trace " << options.trace << "\n";
+    }
+    socket_cleanup();
+    return 0;
+}